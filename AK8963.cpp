@@ -8,12 +8,13 @@
 
 */
 
+#include "singlePrecision.h"
 #include "AK8963.h"
-#include <i2c_t3.h>
 #include <stdio.h>
 #include <math.h>
 #include "state.h"
 #include "config.h"  //CONFIG variable
+#include "MPU9250.h"
 
 // we have three coordinate systems here:
 // 1. REGISTER coordinates: native values as read
@@ -42,6 +43,8 @@ uint8_t AK8963::getID() {
 
 void AK8963::restart() {
     configure();
+    next_read_micros = micros();
+    last_read_micros = next_read_micros;
 }
 
 uint8_t AK8963::getStatusByte() {
@@ -54,24 +57,50 @@ uint8_t AK8963::getStatusByte() {
 
 // writes values to state in milligauss
 bool AK8963::startMeasurement() {
+    uint32_t now = micros();
+    if ((int32_t)(now - next_read_micros) < 0)
+        return false;
+    data_to_send[0] = AK8963_ST1;
+    if (!i2c->addTransfer((uint8_t)AK8963_ADDRESS, (uint8_t)1, &data_to_send[0], (uint8_t)8, &data_to_read[0], this, I2CPriority::Medium))
+        return false;
     ready = false;
-    data_to_send[0] = AK8963_XOUT_L;
-    i2c->addTransfer((uint8_t)AK8963_ADDRESS, (uint8_t)1, &data_to_send[0], (uint8_t)7, &data_to_read[0], this);
     return true;
 }
 
 void AK8963::processCallback(uint8_t count, uint8_t *rawData) {
-    // count should always be 7 if we wanted to check...
+    // count should always be 8 if we wanted to check...
+    // ST1 was read in the middle of the transfer, however long it waited behind the inertial reads
+    uint32_t read_micros = i2c->transferStartMicros() + (i2c->transferEndMicros() - i2c->transferStartMicros()) / 2;
+    uint32_t window = read_micros - last_read_micros;
+    last_read_micros = read_micros;
+    // a new sample was captured somewhere between the previous read and this one
+    uint32_t capture_micros = read_micros - window / 2;
+    if (processSample(rawData, capture_micros))
+        next_read_micros = capture_micros + AK8963_SAMPLE_PERIOD - AK8963_RETRY_PERIOD;
+    else
+        next_read_micros = read_micros + AK8963_RETRY_PERIOD;
+    ready = true;
+}
+
+bool AK8963::processSample(const uint8_t *rawData, uint32_t capture_micros) {
+    uint8_t st1 = rawData[0];
+    if (!(st1 & 0x01)) {  // DRDY: nothing new since the last read
+        if (!through_mpu)  // the MPU9250 copies it at 1kHz, so there nine in ten are expected
+            ++stale;
+        return false;
+    }
+    if (st1 & 0x02)  // DOR: at least one sample was overwritten before we got to it
+        ++skipped;
 
-    uint8_t c = rawData[6];  // ST2 register
+    uint8_t c = rawData[7];  // ST2 register
     if (!(c & 0x08)) {       // Check if magnetic sensor overflow set, if not then report data
         // convert from REGISTER system to IC/PCB system
         // "Measurement data is stored in two’s complement and Little Endian format."
         // be careful not to misinterpret 2's complement registers
         int16_t registerValues[3];
-        registerValues[0] = (int16_t)(((uint16_t)rawData[1]) << 8) | (uint16_t)rawData[0];  // low byte, high byte
-        registerValues[1] = (int16_t)(((uint16_t)rawData[3]) << 8) | (uint16_t)rawData[2];
-        registerValues[2] = (int16_t)(((uint16_t)rawData[5]) << 8) | (uint16_t)rawData[4];
+        registerValues[0] = (int16_t)(((uint16_t)rawData[2]) << 8) | (uint16_t)rawData[1];  // low byte, high byte
+        registerValues[1] = (int16_t)(((uint16_t)rawData[4]) << 8) | (uint16_t)rawData[3];
+        registerValues[2] = (int16_t)(((uint16_t)rawData[6]) << 8) | (uint16_t)rawData[5];
         magCount[0] = MAG_XSIGN * registerValues[MAG_XDIR];
         magCount[1] = MAG_YSIGN * registerValues[MAG_YDIR];
         magCount[2] = MAG_ZSIGN * registerValues[MAG_ZDIR];
@@ -83,13 +112,37 @@ void AK8963::processCallback(uint8_t count, uint8_t *rawData) {
         state->mag[1] = (float)magCount[1] * mRes - CONFIG.data.magBias[1];
         state->mag[2] = (float)magCount[2] * mRes - CONFIG.data.magBias[2];
         rotate(state->R, state->mag);  // rotate to FLYER coords
-        state->updateStateMag();
+        state->updateStateMag(capture_micros);
     } else {
         // ERROR: ("ERROR: Magnetometer overflow!");
     }
+    return true;
+}
+
+void AK8963::processFailure() {
     ready = true;
 }
 
+bool AK8963::setMode(uint8_t cntl1) {
+    if (!through_mpu)
+        return i2c->writeRegisterVerified(mode_write, AK8963_ADDRESS, AK8963_CNTL1, cntl1, I2CPriority::Medium);
+    // slave 0 keeps reading ST1..ST2, slave 4 makes one write and clears its enable bit when it is done
+    if (slave4_setup[0].pending() || slave4_setup[1].pending() || slave4_setup[2].pending() || slave4_start.pending())
+        return false;
+    if (i2c->transferQueue(I2CPriority::Medium).space() < 3)
+        return false;  // all three or none, a partial setup would send stale slave 4 registers
+    slave4_ready = 0;
+    i2c->writeRegisterVerified(slave4_setup[0], MPU9250_ADDRESS, I2C_SLV4_ADDR, AK8963_ADDRESS, I2CPriority::Medium, this);
+    i2c->writeRegisterVerified(slave4_setup[1], MPU9250_ADDRESS, I2C_SLV4_REG, AK8963_CNTL1, I2CPriority::Medium, this);
+    i2c->writeRegisterVerified(slave4_setup[2], MPU9250_ADDRESS, I2C_SLV4_DO, cntl1, I2CPriority::Medium, this);
+    return true;
+}
+
+void AK8963::registerWritten(const I2CRegisterWrite &write, bool success) {
+    if (success && ++slave4_ready == 3)
+        i2c->writeRegister(slave4_start, MPU9250_ADDRESS, I2C_SLV4_CTRL, 0x80, I2CPriority::Medium);  // I2C_SLV4_EN
+}
+
 void AK8963::disable() {
     i2c->writeByte(AK8963_ADDRESS, AK8963_CNTL1, 0x00);  // Power down magnetometer
     delay(100);
@@ -104,9 +157,9 @@ void AK8963::configure() {
     delay(10);
     i2c->readBytes(AK8963_ADDRESS, AK8963_ASAX, 3, &rawData[0]);  // Read the x-, y-, and z-axis sensitivity calibration values
     // adjustment formula is taken from the datasheet
-    magCalibration[0] = (float)(rawData[MAG_XDIR] - 128) / 256. + 1.;
-    magCalibration[1] = (float)(rawData[MAG_YDIR] - 128) / 256. + 1.;
-    magCalibration[2] = (float)(rawData[MAG_ZDIR] - 128) / 256. + 1.;
+    magCalibration[0] = (float)(rawData[MAG_XDIR] - 128) / 256.0f + 1.0f;
+    magCalibration[1] = (float)(rawData[MAG_YDIR] - 128) / 256.0f + 1.0f;
+    magCalibration[2] = (float)(rawData[MAG_ZDIR] - 128) / 256.0f + 1.0f;
     i2c->writeByte(AK8963_ADDRESS, AK8963_CNTL1, 0x00);  // Power down magnetometer
     delay(10);
     i2c->writeByte(AK8963_ADDRESS, AK8963_CNTL1, 0x16);  // Set magnetometer to 16bit, 100Hz continuous acquisition
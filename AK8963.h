@@ -22,7 +22,7 @@ class State;
 // 2. IC/PCB coordinates: matches FLYER system if the pcb is in standard orientation
 // 3. FLYER coordinates: if the pcb is mounted in a non-standard way the FLYER system is a rotation of the IC/PCB system
 
-class AK8963 : public CallbackProcessor {
+class AK8963 : public CallbackProcessor, public RegisterWriteListener {
    public:  // all in FLYER system
     AK8963(State *state, I2CManager *i2c);
 
@@ -30,8 +30,32 @@ class AK8963 : public CallbackProcessor {
 
     bool ready;
 
+    // queues a read of ST1 through ST2 once a new sample should be ready; false if it is not due yet
     bool startMeasurement();  // writes values to state (when data is ready)
     void processCallback(uint8_t count, uint8_t *rawData);  // handles return for getAccelGryo()
+    void processFailure();  // the heading correction simply skips this sample
+
+    // converts an ST1..ST2 block captured at capture_micros and hands it to state; false if it held no new sample
+    bool processSample(const uint8_t *rawData, uint32_t capture_micros);
+
+    uint32_t skippedCount() const {  // samples overwritten before we read them (ST1 DOR)
+        return skipped;
+    }
+
+    uint32_t staleCount() const {  // direct reads that found no new sample (ST1 DRDY clear)
+        return stale;
+    }
+
+    // called by MPU9250::attachMagnetometer; from then on the AK8963 only answers the MPU9250's auxiliary master,
+    // which copies ST1 with every inertial sample, so most copies hold no new sample and are not counted stale
+    void readThroughMpu() {
+        through_mpu = true;
+    }
+
+    // queue a write of CNTL1 (output bit width and measurement mode), safe to call while flying; directly it is
+    // verified, through the MPU9250 it is handed to slave 4 of the auxiliary master once that is set up
+    bool setMode(uint8_t cntl1);
+    void registerWritten(const I2CRegisterWrite &write, bool success);  // starts slave 4 once it is set up
 
     uint8_t getID();
 
@@ -47,17 +71,32 @@ class AK8963 : public CallbackProcessor {
     void configure();
     void disable();
 
-    const float mRes = 10. * 4912. / 32760.0;  // +/- 0.15 uT (or 1.5mG) per LSB; range is -32760...32760
+    const float mRes = 10.0f * 4912.0f / 32760.0f;  // +/- 0.15 uT (or 1.5mG) per LSB; range is -32760...32760
 
     // 16-bit raw values, bias correction, factory calibration
     int16_t magCount[3] = {0, 0, 0};
     // bias is stored in CONFIG
     float magCalibration[3] = {0.0, 0.0, 0.0};
 
+    // continuous mode 2 produces a sample every 10ms; reads aim a little early and retry until ST1 says it is ready
+    uint32_t next_read_micros{0};
+    uint32_t last_read_micros{0};
+    uint32_t skipped{0};
+    uint32_t stale{0};
+
     // buffers for processCallback
-    uint8_t data_to_read[7];
+    // ST1, XOUT_L..ZOUT_H, ST2; reading ST2 releases the data registers for the next sample
+    uint8_t data_to_read[8];
     uint8_t data_to_send[1];
 
+    I2CRegisterWrite mode_write;
+
+    // I2C_SLV4_ADDR, I2C_SLV4_REG and I2C_SLV4_DO, then I2C_SLV4_CTRL to send the write once all three hold
+    bool through_mpu{false};
+    I2CRegisterWrite slave4_setup[3];
+    I2CRegisterWrite slave4_start;
+    uint8_t slave4_ready{0};
+
 };  // class AK8963
 
 #define DEG2RAD 0.01745329251f
@@ -68,6 +107,9 @@ class AK8963 : public CallbackProcessor {
 //
 //*************************************************************
 
+#define AK8963_SAMPLE_PERIOD 10000  // microseconds, continuous measurement mode 2
+#define AK8963_RETRY_PERIOD 1000
+
 #define AK8963_ADDRESS 0x0C
 /*  Page 24: "Pass-Through mode is also used to access the AK8963 magnetometer
     directly from the host. In this configuration the slave address for the AK8963
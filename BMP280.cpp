@@ -6,11 +6,12 @@
 
 //#define BMP280_SERIAL_DEBUG
 
+#include "singlePrecision.h"
 #include "BMP280.h"
 #include <math.h>
-#include <i2c_t3.h>
 #include "state.h"
 #include <stdint.h>
+#include <string.h>
 
 BMP280::BMP280(State *__state, I2CManager *__i2c) {
     state = __state;
@@ -31,6 +32,7 @@ void BMP280::restart() {
     if (!validateCalibation()) {
         // ERROR: ("...WARNING -- CALIBRATION MAY NOT BE RELIABLE!...");
     }
+    prepareFloatCalibration();
 
     // set controls to recommended values
 
@@ -42,6 +44,7 @@ void BMP280::restart() {
     settings |= OSRS_P_X16;
     settings |= MODE_NORMAL;
     i2c->writeByte(BMP280_ADDR, BMP280_REG_CTRL_MEAS, settings);
+    ctrl_meas_setting = settings;
 
     //  t_sb[7,6,5] bits in control register 0xF5 -- 000 (0.5ms sleep)
     // filter[4,3,2] bits in control register 0xF5 -- 111 (16)
@@ -51,9 +54,26 @@ void BMP280::restart() {
     settings |= FILTER_X16;
     settings |= T_SB_0p5ms;
     i2c->writeByte(BMP280_ADDR, BMP280_REG_CONFIG, settings);
+    config_setting = settings;
 
     // resulting measurement rate is 26.32 Hz
+    setMeasurementPeriod(ctrl_meas_setting, config_setting);
     delay(250);  // first few values are bad
+    next_read_micros = micros();
+    last_read_micros = next_read_micros;
+}
+
+void BMP280::setMeasurementPeriod(uint8_t ctrl_meas, uint8_t config) {
+    // datasheet section 3.8.1: t_measure = 1 + 2 * osrs_t + (2 * osrs_p + 0.5) milliseconds, plus t_standby
+    static const uint32_t standby_micros[8] = {500, 62500, 125000, 250000, 500000, 1000000, 2000000, 4000000};
+    uint8_t osrs_t = (ctrl_meas >> 5) & 0x07;
+    uint8_t osrs_p = (ctrl_meas >> 2) & 0x07;
+    uint32_t period = 1000;
+    if (osrs_t)
+        period += 2000 * (1 << (osrs_t < 5 ? osrs_t - 1 : 4));
+    if (osrs_p)
+        period += 2000 * (1 << (osrs_p < 5 ? osrs_p - 1 : 4)) + 500;
+    measurement_period = period + standby_micros[config >> 5];
 }
 
 uint8_t BMP280::getID() {
@@ -73,22 +93,89 @@ boolean BMP280::validateCalibation() {
 #define BMP280_REG_RESULT 0xF7  // 0xF7(msb) , 0xF8(lsb) , 0xF9(xlsb) : stores the pressure data.
                                 // 0xFA(msb) , 0xFB(lsb) , 0xFC(xlsb) : stores the temperature data.
 bool BMP280::startMeasurement(void) {
-    ready = false;
+    uint32_t now = micros();
+    if ((int32_t)(now - next_read_micros) < 0)
+        return false;
     data_to_send[0] = BMP280_REG_RESULT;
-    i2c->addTransfer((uint8_t)BMP280_ADDR, (uint8_t)1, data_to_send, (uint8_t)6, data_to_read, this);
+    if (!i2c->addTransfer((uint8_t)BMP280_ADDR, (uint8_t)1, data_to_send, (uint8_t)6, data_to_read, this, I2CPriority::Low))
+        return false;
+    ready = false;
+    return true;
+}
+
+bool BMP280::newSample() {
+    Sample sample;
+    if (!samples.pop(sample))
+        return false;
+    sample_micros = sample.micros;
+    state->temperature = compensate_T_int32(sample.rawT);  // calculate temp first to update t_fine
+    switch (compensation) {
+        case Compensation::Int32:
+            state->pressure = compensate_P_int32(sample.rawP) << 8;
+            break;
+        case Compensation::Int64:
+            state->pressure = compensate_P_int64(sample.rawP);
+            break;
+        case Compensation::Float:
+            state->pressure = compensate_P_float(sample.rawP);
+            break;
+    }
     return true;
 }
 
 void BMP280::processCallback(uint8_t count, uint8_t *data) {
     // count should always be 6 if we wanted to check...
-    int32_t rawP, rawT;
-    rawP = (((int32_t)data[0]) << 12) + (((int32_t)data[1]) << 4) + (((int32_t)data[2]) >> 4);
-    rawT = (((int32_t)data[3]) << 12) + (((int32_t)data[4]) << 4) + (((int32_t)data[5]) >> 4);
-    state->temperature = compensate_T_int32(rawT);  // calculate temp first to update t_fine
-    state->pressure = compensate_P_int64(rawP);
+    // the result registers were read in the middle of the transfer, however long it waited behind others
+    uint32_t read_micros = i2c->transferStartMicros() + (i2c->transferEndMicros() - i2c->transferStartMicros()) / 2;
+    uint32_t window = read_micros - last_read_micros;
+    last_read_micros = read_micros;
+    if (!memcmp(data, last_result, sizeof(last_result))) {
+        // the conversion has not ended yet
+        ++duplicates;
+        next_read_micros = read_micros + BMP280_RETRY_PERIOD;
+        ready = true;
+        return;
+    }
+    memcpy(last_result, data, sizeof(last_result));
+
+    // it ended somewhere between the previous read and this one
+    Sample sample;
+    sample.micros = read_micros - window / 2;
+    next_read_micros = sample.micros + measurement_period - BMP280_RETRY_PERIOD;
+    sample.rawP = (((int32_t)data[0]) << 12) + (((int32_t)data[1]) << 4) + (((int32_t)data[2]) >> 4);
+    sample.rawT = (((int32_t)data[3]) << 12) + (((int32_t)data[4]) << 4) + (((int32_t)data[5]) >> 4);
+    samples.push(sample);
+    ready = true;
+}
+
+void BMP280::processFailure() {
     ready = true;
 }
 
+bool BMP280::setControl(uint8_t ctrl_meas, uint8_t config) {
+    if (ctrl_meas_write.pending() || config_write.pending())
+        return false;
+    // both writes or neither, so a refused change never leaves the sensor half configured
+    if (i2c->transferQueue(I2CPriority::Low).space() < 2)
+        return false;
+    // writes to CONFIG may be ignored in normal mode, the read back catches that and writes again
+    i2c->writeRegisterVerified(ctrl_meas_write, BMP280_ADDR, BMP280_REG_CTRL_MEAS, ctrl_meas, I2CPriority::Low, this);
+    i2c->writeRegisterVerified(config_write, BMP280_ADDR, BMP280_REG_CONFIG, config, I2CPriority::Low, this);
+    return true;
+}
+
+void BMP280::registerWritten(const I2CRegisterWrite &write, bool success) {
+    if (!success) {
+        ++config_failures;
+        return;
+    }
+    if (&write == &ctrl_meas_write)
+        ctrl_meas_setting = write.value();
+    else if (&write == &config_write)
+        config_setting = write.value();
+    setMeasurementPeriod(ctrl_meas_setting, config_setting);
+}
+
 // Returns temperature in DegC, resolution is 0.01 DegC. Output value of “5123” equals 51.23 DegC.
 uint16_t BMP280::compensate_T_int32(int32_t rawT) {
     int32_t var1, var2;
@@ -145,3 +232,31 @@ uint32_t BMP280::compensate_P_int64(int32_t rawP) {
     p = ((p + var1 + var2) >> 8) + (((int64_t)CALIBRATION.val.dig_P7) << 4);
     return (uint32_t)p;
 }
+
+void BMP280::prepareFloatCalibration() {
+    const BMP_calibration &c = CALIBRATION.val;
+    float_calibration.p1 = (float)c.dig_P1;
+    float_calibration.p1_scaled = (float)c.dig_P1 / 32768.0f;
+    float_calibration.p2 = (float)c.dig_P2 / 524288.0f;
+    float_calibration.p3 = (float)c.dig_P3 / 524288.0f / 524288.0f;
+    float_calibration.p4 = (float)c.dig_P4 * 65536.0f;
+    float_calibration.p5 = (float)c.dig_P5 * 0.5f;
+    float_calibration.p6 = (float)c.dig_P6 / 131072.0f;
+    float_calibration.p7 = (float)c.dig_P7 / 16.0f;
+    float_calibration.p8 = (float)c.dig_P8 / 524288.0f;
+    float_calibration.p9 = (float)c.dig_P9 / 34359738368.0f;
+}
+
+// Returns pressure in Pa as unsigned 32 bit integer in Q24.8 format, like compensate_P_int64
+uint32_t BMP280::compensate_P_float(int32_t rawP) {
+    const auto &c = float_calibration;
+    float var1 = (float)t_fine * 0.5f - 64000.0f;
+    float var2 = var1 * var1 * c.p6 + var1 * c.p5 + c.p4;
+    var1 = (c.p3 * var1 + c.p2) * var1 * c.p1_scaled + c.p1;
+    if (var1 == 0.0f) {
+        return 0;  // avoid exception caused by division by zero
+    }
+    float p = (1048576.0f - (float)rawP - var2 / 4096.0f) * 6250.0f / var1;
+    p += (c.p9 * p + c.p8) * p + c.p7;
+    return (uint32_t)(p * 256.0f);
+}
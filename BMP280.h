@@ -14,6 +14,7 @@
 
 #include "Arduino.h"
 #include "i2cManager.h"
+#include "sampleRing.h"
 
 class State;
 
@@ -38,8 +39,15 @@ union BMP_calibration_union {
     uint8_t raw[sizeof(struct BMP_calibration)];
 };
 
-class BMP280 : public CallbackProcessor {
+class BMP280 : public CallbackProcessor, public RegisterWriteListener {
    public:
+    // pressure compensation; all three produce Q24.8 Pa, temperature always uses the int32 formula
+    enum class Compensation : uint8_t {
+        Int32,  // datasheet 32 bit integer formula; whole Pa only
+        Int64,  // datasheet 64 bit formula; most accurate, but 64 bit math is slow on the Cortex-M4
+        Float,  // datasheet floating point formula in single precision, coefficients prepared in restart()
+    };
+
     BMP280(State *state, I2CManager *i2c);  // base type
 
     void restart();
@@ -48,8 +56,33 @@ class BMP280 : public CallbackProcessor {
 
     uint8_t getID();
 
+    // queues a read of the result registers once a new conversion should be done; false if it is not due yet
     bool startMeasurement();
     void processCallback(uint8_t count, uint8_t *rawData);  // handles return for getPT()
+    void processFailure();  // keeps the previous pressure so the altitude filter coasts on it
+
+    void setCompensation(Compensation mode) {
+        compensation = mode;
+    }
+
+    bool newSample();  // writes the oldest unused pressure and temperature to state; false if there is none
+
+    uint32_t sampleMicros() const {  // estimated end of the conversion behind the latest fresh sample
+        return sample_micros;
+    }
+
+    uint32_t duplicateCount() const {  // reads that returned the same conversion as the one before
+        return duplicates;
+    }
+
+    // queue verified writes of CTRL_MEAS (oversampling and mode) and CONFIG (standby time and IIR filter),
+    // safe to call while flying; returns false if a previous change is still in flight
+    bool setControl(uint8_t ctrl_meas, uint8_t config);
+    void registerWritten(const I2CRegisterWrite &write, bool success);  // settles a setControl write
+
+    uint32_t configFailureCount() const {  // setControl writes the sensor never confirmed
+        return config_failures;
+    }
 
    private:
     State *state;
@@ -63,16 +96,57 @@ class BMP280 : public CallbackProcessor {
     uint16_t compensate_T_int32(int32_t rawT);
     uint32_t compensate_P_int32(int32_t rawP);
     uint32_t compensate_P_int64(int32_t rawP);  // higher accuracy; 10x more computation; Q24.8 format
+    uint32_t compensate_P_float(int32_t rawP);  // Q24.8 format
+
+    void prepareFloatCalibration();
+
+    Compensation compensation{Compensation::Int64};
+
+    // dig_P* folded with the constant factors of the floating point formula
+    struct {
+        float p1, p1_scaled;
+        float p2, p3;
+        float p4, p5, p6;
+        float p7, p8, p9;
+    } float_calibration;
 
     int32_t t_fine;
 
+    void setMeasurementPeriod(uint8_t ctrl_meas, uint8_t config);
+
+    // register contents the sensor confirmed; the read schedule follows them, not the requested ones
+    uint8_t ctrl_meas_setting{0};
+    uint8_t config_setting{0};
+    uint32_t config_failures{0};
+
+    // the sensor free-runs in normal mode, so its conversions are tracked from the data: the next read is aimed a
+    // little before the next conversion should end, and repeated every BMP280_RETRY_PERIOD until the data changes
+    uint32_t measurement_period{38000};  // microseconds
+    uint32_t next_read_micros{0};
+    uint32_t last_read_micros{0};
+    uint32_t sample_micros{0};
+    uint32_t duplicates{0};
+
+    struct Sample {
+        uint32_t micros;
+        int32_t rawP;
+        int32_t rawT;
+    };
+    SampleRing<Sample, 4> samples;
+    uint8_t last_result[6]{0};
+
     // buffers for processCallback
     uint8_t data_to_read[6];
     uint8_t data_to_send[1];
+
+    I2CRegisterWrite ctrl_meas_write;
+    I2CRegisterWrite config_write;
 };
 
 #define BMP280_ADDR 0x77  // 7-bit address
 
+#define BMP280_RETRY_PERIOD 2000  // microseconds between reads while waiting for a conversion to end
+
 #define BMP280_REG_ID 0xD0
 #define BMP280_REG_RESET 0xE0
 #define BMP280_REG_STATUS 0xF3
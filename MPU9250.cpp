@@ -8,11 +8,14 @@
 
 */
 
+#include "singlePrecision.h"
 #include "MPU9250.h"
-#include <i2c_t3.h>
+#include "AK8963.h"
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
 #include "state.h"
+#include "timing.h"
 
 // we have three coordinate systems here:
 // 1. REGISTER coordinates: native values as read
@@ -36,6 +39,10 @@
 #define GYRO_YSIGN 1
 #define GYRO_ZSIGN 1  // verified by experiment
 
+namespace {
+MPU9250 *interrupt_target{nullptr};
+}
+
 MPU9250::MPU9250(State *__state, I2CManager *__i2c) {
     state = __state;
     i2c = __i2c;
@@ -48,13 +55,46 @@ uint8_t MPU9250::getID() {
 }
 
 void MPU9250::restart() {
+    detachInterrupt(MPU_INTERRUPT);
     reset();
     configure();
     forgetBiasValues();
+    interrupt_target = this;
+    data_ready = false;
+    attachInterrupt(MPU_INTERRUPT, dataReadyISR, RISING);
+}
+
+void MPU9250::dataReadyISR() {
+    // timestamp the edge here; the loop would otherwise stamp it whenever it got around to polling the pin
+    uint32_t now = micros();
+    interrupt_target->data_ready_micros = now;
+    interrupt_target->edge_history[interrupt_target->edge_count++ % EDGE_HISTORY] = now;
+    interrupt_target->data_ready = true;
+    if (interrupt_target->pending_samples < 255)
+        ++interrupt_target->pending_samples;
 }
 
 bool MPU9250::dataReadyInterrupt() {
-    return digitalRead(MPU_INTERRUPT);  // use the interrupt pin -- be sure to set INT_PIN_CFG
+    noInterrupts();
+    bool ready_now = data_ready;
+    if (ready_now) {
+        data_ready = false;
+        edge_micros = data_ready_micros;
+    }
+    interrupts();
+    return ready_now;
+}
+
+uint32_t MPU9250::edgeBefore(uint32_t when) {
+    uint32_t edge = 0;
+    noInterrupts();
+    for (uint8_t i = 1; i <= EDGE_HISTORY; ++i) {
+        edge = edge_history[(uint8_t)(edge_count - i) % EDGE_HISTORY];
+        if ((int32_t)(when - edge) >= 0)
+            break;
+    }
+    interrupts();
+    return edge;
 }
 
 uint8_t MPU9250::getStatusByte() {
@@ -139,6 +179,8 @@ void MPU9250::correctBiasValues()  // all in FLYER system
     for (uint8_t i = 0; i < 3; i++) {  // construct biases for later manual subtraction
         gyroBias[i] = (float)state->gyro_filter[i];
     }
+
+    updateTransforms();
 }
 
 void MPU9250::forgetBiasValues() {
@@ -158,54 +200,181 @@ void MPU9250::forgetBiasValues() {
     state->R[2][0] = 0.0f;
     state->R[2][1] = 0.0f;
     state->R[2][2] = 1.0f;
+
+    updateTransforms();
 }
 
-// writes values to state in g's and in degrees per second
 bool MPU9250::startMeasurement() {
+    if (fifo_batch)
+        return startFifoRead();
     if (dataReadyInterrupt()) {
-        ready = false;
+        request_micros = micros();
         data_to_send[0] = ACCEL_XOUT_H;
-        i2c->addTransfer((uint8_t)MPU9250_ADDRESS, (uint8_t)1, &data_to_send[0], (uint8_t)14, &data_to_read[0], this);
+        uint8_t count = magnetometer ? 22 : 14;
+        if (!i2c->addTransfer((uint8_t)MPU9250_ADDRESS, (uint8_t)1, &data_to_send[0], count, &data_to_read[0], this, I2CPriority::High))
+            return false;
+        stage = ReadStage::Sample;
+        ready = false;
         return true;
     }
     return false;
 }
 
+bool MPU9250::startFifoRead() {
+    noInterrupts();
+    bool due = pending_samples >= fifo_batch;
+    if (due) {
+        pending_samples = 0;
+        edge_micros = data_ready_micros;
+    }
+    interrupts();
+    if (!due)
+        return false;
+    request_micros = micros();
+    data_to_send[0] = FIFO_COUNTH;
+    if (!i2c->addTransfer((uint8_t)MPU9250_ADDRESS, (uint8_t)1, &data_to_send[0], (uint8_t)2, &fifo_count_data[0], this, I2CPriority::High))
+        return false;
+    stage = ReadStage::FifoCount;
+    ready = false;
+    return true;
+}
+
+void MPU9250::resetFifo() {
+    fifo_reset_data[0] = USER_CTRL;
+    fifo_reset_data[1] = user_ctrl | 0x04;  // FIFO_RST clears itself
+    if (!i2c->addTransfer((uint8_t)MPU9250_ADDRESS, (uint8_t)2, &fifo_reset_data[0], (uint8_t)0, nullptr, this, I2CPriority::High)) {
+        ready = true;
+        return;
+    }
+    stage = ReadStage::FifoReset;
+}
+
 void MPU9250::processCallback(uint8_t count, uint8_t *rawData) {
-    // count should always be 14 if we wanted to check...
+    switch (stage) {
+        case ReadStage::Sample:
+            // count should always be 14 (or 22 with the magnetometer attached) if we wanted to check...
+            // jitter is the edge-to-request latency, duration is the time the request spent on the bus
+            timing_probes[uint8_t(TimingProbe::IMURead)].record(edge_micros, request_micros, micros());
+            // be careful not to misinterpret 2's complement registers
+            temperatureCount[0] = (int16_t)(((uint16_t)rawData[6]) << 8) | (uint16_t)rawData[7];
+            // the burst holds the newest sample when it reached the bus, which may be after the edge that asked for it
+            pushSample(edgeBefore(i2c->receiveStartMicros()), rawData, rawData + 8, rawData + 14);
+            ready = true;
+            break;
 
-    // convert from REGISTER system to IC/PCB system
-    int16_t registerValuesAccel[3];
-    // be careful not to misinterpret 2's complement registers
-    registerValuesAccel[0] = (int16_t)(((uint16_t)rawData[0]) << 8) | (uint16_t)rawData[1];  // high byte, low byte
-    registerValuesAccel[1] = (int16_t)(((uint16_t)rawData[2]) << 8) | (uint16_t)rawData[3];
-    registerValuesAccel[2] = (int16_t)(((uint16_t)rawData[4]) << 8) | (uint16_t)rawData[5];
-    accelCount[0] = ACCEL_XSIGN * registerValuesAccel[ACCEL_XDIR];
-    accelCount[1] = ACCEL_YSIGN * registerValuesAccel[ACCEL_YDIR];
-    accelCount[2] = ACCEL_ZSIGN * registerValuesAccel[ACCEL_ZDIR];
+        case ReadStage::FifoCount: {
+            uint16_t bytes = (((uint16_t)rawData[0]) << 8) | (uint16_t)rawData[1];
+            // the newest sample counted; edges after FIFO_COUNT was read belong to the next batch
+            newest_micros = edgeBefore(i2c->receiveStartMicros());
+            if ((bytes % fifo_record) || (bytes > MPU_FIFO_SIZE - fifo_record)) {
+                resetFifo();  // overflowed, and the records are no longer aligned
+                break;
+            }
+            uint8_t available = bytes / fifo_record;
+            uint8_t batch = available < MAX_FIFO_BATCH ? available : MAX_FIFO_BATCH;
+            fifo_backlog = available - batch;
+            data_to_send[0] = FIFO_R_W;
+            if (!batch || !i2c->addTransfer((uint8_t)MPU9250_ADDRESS, (uint8_t)1, &data_to_send[0], batch * fifo_record, &data_to_read[0], this, I2CPriority::High)) {
+                ready = true;
+                break;
+            }
+            stage = ReadStage::FifoData;
+            break;
+        }
 
-    // be careful not to misinterpret 2's complement registers
-    temperatureCount[0] = (int16_t)(((uint16_t)rawData[6]) << 8) | (uint16_t)rawData[7];
+        case ReadStage::FifoData: {
+            timing_probes[uint8_t(TimingProbe::IMURead)].record(edge_micros, request_micros, micros());
+            uint8_t batch_count = count / fifo_record;
+            for (uint8_t i = 0; i < batch_count; ++i) {
+                const uint8_t *record = rawData + i * fifo_record;
+                // FIFO samples are evenly spaced, the newest one arrived with the edge before FIFO_COUNT was read
+                pushSample(newest_micros - (fifo_backlog + batch_count - 1 - i) * MPU_SAMPLE_PERIOD, record, record + 6, record + 12);
+            }
+            if (fifo_backlog) {  // come back for the rest right away
+                noInterrupts();
+                pending_samples = fifo_batch;
+                interrupts();
+            }
+            ready = true;
+            break;
+        }
 
-    int16_t registerValuesGyro[3];
+        case ReadStage::FifoReset:
+            ready = true;
+            break;
+    }
+}
+
+void MPU9250::pushSample(uint32_t capture_micros, const uint8_t *accelData, const uint8_t *gyroData, const uint8_t *magData) {
+    Sample sample;
+    sample.micros = capture_micros;
     // be careful not to misinterpret 2's complement registers
-    registerValuesGyro[0] = (int16_t)(((uint16_t)rawData[8]) << 8) | (uint16_t)rawData[9];  // high byte, low byte
-    registerValuesGyro[1] = (int16_t)(((uint16_t)rawData[10]) << 8) | (uint16_t)rawData[11];
-    registerValuesGyro[2] = (int16_t)(((uint16_t)rawData[12]) << 8) | (uint16_t)rawData[13];
-    gyroCount[0] = GYRO_XSIGN * registerValuesGyro[GYRO_XDIR];
-    gyroCount[1] = GYRO_YSIGN * registerValuesGyro[GYRO_YDIR];
-    gyroCount[2] = GYRO_ZSIGN * registerValuesGyro[GYRO_ZDIR];
-
-    state->accel[0] = (float)accelCount[0] * aRes - accelBias[0];
-    state->accel[1] = (float)accelCount[1] * aRes - accelBias[1];
-    state->accel[2] = (float)accelCount[2] * aRes - accelBias[2];
-    rotate(state->R, state->accel);  // rotate to FLYER coords
-
-    state->gyro[0] = (float)gyroCount[0] * gRes - gyroBias[0];
-    state->gyro[1] = (float)gyroCount[1] * gRes - gyroBias[1];
-    state->gyro[2] = (float)gyroCount[2] * gRes - gyroBias[2];
-    rotate(state->R, state->gyro);  // rotate to FLYER coords
+    for (uint8_t i = 0; i < 3; i++) {
+        sample.accel[i] = (int16_t)((((uint16_t)accelData[2 * i]) << 8) | (uint16_t)accelData[2 * i + 1]);  // high byte, low byte
+        sample.gyro[i] = (int16_t)((((uint16_t)gyroData[2 * i]) << 8) | (uint16_t)gyroData[2 * i + 1]);
+    }
+    if (magnetometer)
+        memcpy(sample.mag, magData, sizeof(sample.mag));
+    samples.push(sample);
+}
+
+bool MPU9250::nextSample() {
+    Sample sample;
+    while (samples.pop(sample)) {
+        sample_micros = sample.micros;
+        if (micros() - sample_micros > late_micros)
+            ++late_samples;
+        convertSample(sample);
+        if (magnetometer)
+            magnetometer->processSample(sample.mag, sample_micros);
+
+        if (decimation <= 1)
+            return true;
+        for (uint8_t i = 0; i < 3; i++) {
+            state->gyro[i] = gyro_antialias[i].apply(state->gyro[i]);
+            state->accel[i] = accel_antialias[i].apply(state->accel[i]);
+        }
+        if (++decimation_phase == decimation) {
+            decimation_phase = 0;
+            return true;
+        }
+    }
+    return false;
+}
 
+void MPU9250::convertSample(const Sample &sample) {
+    float registerValuesAccel[3] = {(float)sample.accel[0], (float)sample.accel[1], (float)sample.accel[2]};
+    float registerValuesGyro[3] = {(float)sample.gyro[0], (float)sample.gyro[1], (float)sample.gyro[2]};
+
+    // straight from REGISTER to FLYER coordinates
+    for (uint8_t i = 0; i < 3; i++) {
+        state->accel[i] = accelTransform[i][0] * registerValuesAccel[0] + accelTransform[i][1] * registerValuesAccel[1] + accelTransform[i][2] * registerValuesAccel[2] + accelTransform[i][3];
+        state->gyro[i] = gyroTransform[i][0] * registerValuesGyro[0] + gyroTransform[i][1] * registerValuesGyro[1] + gyroTransform[i][2] * registerValuesGyro[2] + gyroTransform[i][3];
+    }
+}
+
+void MPU9250::updateTransforms() {
+    // a sample used to be mapped to IC/PCB coordinates (axis, sign, scale), have its bias removed and then be
+    // rotated by R; all of that is linear, so fold it into one affine transform per sensor:
+    // flyer[i] = sum_j R[i][j] * (sign[j] * res * raw[dir[j]] - bias[j])
+    const uint8_t accelDir[3] = {ACCEL_XDIR, ACCEL_YDIR, ACCEL_ZDIR};
+    const float accelScale[3] = {ACCEL_XSIGN * aRes, ACCEL_YSIGN * aRes, ACCEL_ZSIGN * aRes};
+    const uint8_t gyroDir[3] = {GYRO_XDIR, GYRO_YDIR, GYRO_ZDIR};
+    const float gyroScale[3] = {GYRO_XSIGN * gRes, GYRO_YSIGN * gRes, GYRO_ZSIGN * gRes};
+
+    for (uint8_t i = 0; i < 3; i++) {
+        accelTransform[i][3] = 0.0f;
+        gyroTransform[i][3] = 0.0f;
+        for (uint8_t j = 0; j < 3; j++) {
+            accelTransform[i][accelDir[j]] = state->R[i][j] * accelScale[j];
+            gyroTransform[i][gyroDir[j]] = state->R[i][j] * gyroScale[j];
+            accelTransform[i][3] -= state->R[i][j] * accelBias[j];
+            gyroTransform[i][3] -= state->R[i][j] * gyroBias[j];
+        }
+    }
+}
+
+void MPU9250::processFailure() {
     ready = true;
 }
 
@@ -214,83 +383,61 @@ void MPU9250::reset() {
     delay(100);
 }
 
-void MPU9250::setFilters(uint8_t gyrofilter, uint8_t accelfilter) {
-    // register MPU9250_CONFIG (0x1A) contains gyro and temp filters:
-    switch (gyrofilter) {
-        case 0:
-            // 250     0.97    8       4000    0.04
-            i2c->writeByte(MPU9250_ADDRESS, MPU9250_CONFIG, 0x00);
-            break;
-        case 1:
-            // 184     2.9     1       188     1.9
-            i2c->writeByte(MPU9250_ADDRESS, MPU9250_CONFIG, 0x01);
-            break;
-        case 2:
-            // 92      3.9     1       98      2.8
-            i2c->writeByte(MPU9250_ADDRESS, MPU9250_CONFIG, 0x02);
-            break;
-        case 3:
-            // 41      5.9     1       42      4.8
-            i2c->writeByte(MPU9250_ADDRESS, MPU9250_CONFIG, 0x03);
-            break;
-        case 4:
-            // 20      9.9     1       20      8.3
-            i2c->writeByte(MPU9250_ADDRESS, MPU9250_CONFIG, 0x04);
-            break;
-        case 5:
-            // 10      17.85   1       10      13.4
-            i2c->writeByte(MPU9250_ADDRESS, MPU9250_CONFIG, 0x05);
-            break;
-        case 6:
-            // 5       33.48   1       5       18.6
-            i2c->writeByte(MPU9250_ADDRESS, MPU9250_CONFIG, 0x06);
-            break;
-        case 7:
-            // 3600    0.17    8       4000    0.04
-            i2c->writeByte(MPU9250_ADDRESS, MPU9250_CONFIG, 0x07);
-            break;
-        default:
-            // bad value
-            break;
-    }
-    // register ACCEL_CONFIG2 (0x1D) contains accel filter:
-    switch (accelfilter) {
-        case 0:
-            // 460     1.94        250
-            i2c->writeByte(MPU9250_ADDRESS, ACCEL_CONFIG2, 0x00);
-            break;
-        case 1:
-            // 184     5.80        250
-            i2c->writeByte(MPU9250_ADDRESS, ACCEL_CONFIG2, 0x01);
-            break;
-        case 2:
-            // 92      7.80        250
-            i2c->writeByte(MPU9250_ADDRESS, ACCEL_CONFIG2, 0x02);
-            break;
-        case 3:
-            // 41      11.80       250
-            i2c->writeByte(MPU9250_ADDRESS, ACCEL_CONFIG2, 0x03);
-            break;
-        case 4:
-            // 20      19.80       250
-            i2c->writeByte(MPU9250_ADDRESS, ACCEL_CONFIG2, 0x04);
-            break;
-        case 5:
-            // 10      35.70       250
-            i2c->writeByte(MPU9250_ADDRESS, ACCEL_CONFIG2, 0x05);
-            break;
-        case 6:
-            // 5       66.96       250
-            i2c->writeByte(MPU9250_ADDRESS, ACCEL_CONFIG2, 0x06);
-            break;
-        case 7:
-            // 460     1.94        250
-            i2c->writeByte(MPU9250_ADDRESS, ACCEL_CONFIG2, 0x07);
-            break;
-        default:
-            // bad value
-            break;
+bool MPU9250::setFilters(uint8_t gyrofilter, uint8_t accelfilter) {
+    if (gyrofilter > 7 || accelfilter > 7)
+        return false;  // bad value
+    if (gyrofilter == 0 || gyrofilter == 7)
+        return false;  // 8kHz internal rate, which ignores SMPLRT_DIV and breaks MPU_SAMPLE_PERIOD
+    if (gyro_filter_write.pending() || accel_filter_write.pending())
+        return false;
+
+    // register MPU9250_CONFIG (0x1A) contains gyro and temp filters, DLPF_CFG is bits 2:0:
+    //      gyro                    temperature
+    //      bandwidth delay  Fs     bandwidth delay
+    //      (Hz)      (ms)   (kHz)  (Hz)      (ms)
+    // 0:   250       0.97   8      4000      0.04
+    // 1:   184       2.9    1      188       1.9
+    // 2:   92        3.9    1      98        2.8
+    // 3:   41        5.9    1      42        4.8
+    // 4:   20        9.9    1      20        8.3
+    // 5:   10        17.85  1      10        13.4
+    // 6:   5         33.48  1      5         18.6
+    // 7:   3600      0.17   8      4000      0.04
+
+    // register ACCEL_CONFIG2 (0x1D) contains accel filter, A_DLPFCFG is bits 2:0:
+    //      bandwidth delay  noise density
+    //      (Hz)      (ms)   (ug/rtHz)
+    // 0:   460       1.94   250
+    // 1:   184       5.80   250
+    // 2:   92        7.80   250
+    // 3:   41        11.80  250
+    // 4:   20        19.80  250
+    // 5:   10        35.70  250
+    // 6:   5         66.96  250
+    // 7:   460       1.94   250
+
+    // both writes or neither, so a refused change never leaves the sensor half configured
+    if (i2c->transferQueue(I2CPriority::Low).space() < 2)
+        return false;
+    // low priority, so the retune waits for the inertial reads instead of delaying them
+    i2c->writeRegisterVerified(gyro_filter_write, MPU9250_ADDRESS, MPU9250_CONFIG, gyrofilter, I2CPriority::Low, this);
+    i2c->writeRegisterVerified(accel_filter_write, MPU9250_ADDRESS, ACCEL_CONFIG2, accelfilter, I2CPriority::Low, this);
+    return true;
+}
+
+void MPU9250::registerWritten(const I2CRegisterWrite &write, bool success) {
+    if (!success) {
+        ++config_failures;  // the sensor keeps whatever it had, and so does accel_filter_setting
+        return;
     }
+    if (&write == &accel_filter_write)
+        accel_filter_setting = write.value();
+}
+
+uint32_t MPU9250::accelDelayMicros() const {
+    // the delay column of the ACCEL_CONFIG2 table above
+    static const uint32_t delay_micros[8] = {1940, 5800, 7800, 11800, 19800, 35700, 66960, 1940};
+    return delay_micros[accel_filter_setting];
 }
 
 void MPU9250::configure() {
@@ -308,39 +455,67 @@ void MPU9250::configure() {
     i2c->writeByte(MPU9250_ADDRESS, GYRO_CONFIG, 0x10);
     // Set accelerometer to +/-8g resolution
     i2c->writeByte(MPU9250_ADDRESS, ACCEL_CONFIG, 0x10);  // 0x00=+/-2g; Ox08=+/-4g;0x10=+/-8g,0x18=+/-16g
-    // Set accelerometer to 5Hz low pass / 1kHz output rate (before SMPLRT_DIV)
-    i2c->writeByte(MPU9250_ADDRESS, ACCEL_CONFIG2, 0x06);
+    // Set accelerometer to 92Hz low pass / 1kHz output rate (before SMPLRT_DIV)
+    // the 5Hz setting delayed every sample by ~67ms; State filters each consumer in software instead
+    i2c->writeByte(MPU9250_ADDRESS, ACCEL_CONFIG2, 0x02);
+    accel_filter_setting = 0x02;
     // Configure Interrupts and Bypass Enable
     // Set interrupt pin active high, push-pull, enable I2C_BYPASS_EN so additional chips
     // can join the I2C bus and all can be controlled by the Arduino as master
     //  -- 0x22 or 0x32 depending on dataReady() mode above --
     // i2c->writeByte(MPU9250_ADDRESS, INT_PIN_CFG, 0x22); // clear interrupt by reading INT_STATUS
-    i2c->writeByte(MPU9250_ADDRESS, INT_PIN_CFG, 0x32);  // clear interrupt by any read operation
+    // i2c->writeByte(MPU9250_ADDRESS, INT_PIN_CFG, 0x32);  // clear interrupt by any read operation
+    // a 50us pulse per sample (no latch) gives one edge per sample for dataReadyISR, even if a read is missed
+    i2c->writeByte(MPU9250_ADDRESS, INT_PIN_CFG, 0x12);
     i2c->writeByte(MPU9250_ADDRESS, INT_ENABLE, 0x01);   // Enable data ready (bit 0) interrupt
 }
 
-void MPU9250::rotate(float R[3][3], float x[3]) {
-    /* R is [3][3] - [row][col], x is [3] */
-    float y[3] = {0.0, 0.0, 0.0};
-    float sum = 0.0;
-    for (uint8_t i = 0; i < 3; i++) {
-        sum = 0.0;
-        for (uint8_t j = 0; j < 3; j++) {
-            sum += R[i][j] * x[j];
-        }
-        y[i] = sum;
-    }
+void MPU9250::attachMagnetometer(AK8963 *mag) {
+    // bypass off so the MPU owns its auxiliary bus; data-ready still clears on any read
+    i2c->writeByte(MPU9250_ADDRESS, INT_PIN_CFG, 0x10);
+    i2c->writeByte(MPU9250_ADDRESS, USER_CTRL, 0x20);     // I2C_MST_EN
+    i2c->writeByte(MPU9250_ADDRESS, I2C_MST_CTRL, 0x4D);  // WAIT_FOR_ES, 400kHz auxiliary bus
+    // slave 0 reads ST1..ST2 every sample; reading ST2 releases the AK8963 data registers for the next measurement
+    i2c->writeByte(MPU9250_ADDRESS, I2C_SLV0_ADDR, 0x80 | AK8963_ADDRESS);
+    i2c->writeByte(MPU9250_ADDRESS, I2C_SLV0_REG, AK8963_ST1);
+    i2c->writeByte(MPU9250_ADDRESS, I2C_SLV0_CTRL, 0x88);  // enable, 8 bytes into EXT_SENS_DATA_00..07
+    magnetometer = mag;
+    magnetometer->readThroughMpu();
+}
+
+void MPU9250::setDecimation(uint8_t factor, float cutoff_hz) {
+    decimation = factor ? factor : 1;
+    decimation_phase = 0;
     for (uint8_t i = 0; i < 3; i++) {
-        x[i] = y[i];
+        gyro_antialias[i] = Biquad(cutoff_hz, 1000000.0f / MPU_SAMPLE_PERIOD);
+        gyro_antialias[i].reset(state->gyro[i]);
+        accel_antialias[i] = Biquad(cutoff_hz, 1000000.0f / MPU_SAMPLE_PERIOD);
+        accel_antialias[i].reset(state->accel[i]);
     }
 }
 
+void MPU9250::enableFifo(uint8_t batch_size) {
+    // the sample rate stays at 1kHz: 8kHz of 12 byte records would need more than the whole 400kHz bus
+    user_ctrl = (magnetometer ? 0x20 : 0x00) | 0x40;  // keep I2C_MST_EN, add FIFO_EN
+    fifo_record = magnetometer ? 20 : 12;
+    i2c->writeByte(MPU9250_ADDRESS, FIFO_EN, 0x00);
+    i2c->writeByte(MPU9250_ADDRESS, USER_CTRL, user_ctrl | 0x04);  // FIFO_RST
+    // accel and gyro xyz, plus the slave 0 (magnetometer) bytes if attached
+    i2c->writeByte(MPU9250_ADDRESS, FIFO_EN, magnetometer ? 0x79 : 0x78);
+    fifo_batch = constrain(batch_size, 1, MAX_FIFO_BATCH);
+    late_micros = (fifo_batch + 2) * MPU_SAMPLE_PERIOD;
+    noInterrupts();
+    pending_samples = 0;
+    interrupts();
+}
+
 float MPU9250::invSqrt(float x) {
     float halfx = 0.5f * x;
     float y = x;
-    long i = *(long *)&y;
+    int32_t i;
+    memcpy(&i, &y, sizeof(i));  // long is 64 bits off the Teensy, and the pointer cast breaks aliasing rules
     i = 0x5f3759df - (i >> 1);
-    y = *(float *)&i;
+    memcpy(&y, &i, sizeof(y));
     y = y * (1.5f - (halfx * y * y));
     return y;
 }
@@ -14,15 +14,21 @@
 
 #include "Arduino.h"
 #include "i2cManager.h"
+#include "biquad.h"
+#include "sampleRing.h"
 
+class AK8963;
 class State;
 
+#define MPU_SAMPLE_PERIOD 1000  // microseconds, with SMPLRT_DIV 0 and the gyro DLPF enabled
+#define MPU_FIFO_SIZE 512
+
 // we have three coordinate systems here:
 // 1. REGISTER coordinates: native values as read
 // 2. IC/PCB coordinates: matches FLYER system if the pcb is in standard orientation
 // 3. FLYER coordinates: if the pcb is mounted in a non-standard way the FLYER system is a rotation of the IC/PCB system
 
-class MPU9250 : public CallbackProcessor {
+class MPU9250 : public CallbackProcessor, public RegisterWriteListener {
    public:  // all in FLYER system
     MPU9250(State *state, I2CManager *i2c);
 
@@ -33,41 +39,147 @@ class MPU9250 : public CallbackProcessor {
     void correctBiasValues();  // set bias values from state
     void forgetBiasValues();  // discard bias values
 
+    static const uint8_t MAX_FIFO_BATCH = 8;
+
     bool startMeasurement();
     void processCallback(uint8_t count, uint8_t *rawData);  // handles return for getAccelGryo()
+    void processFailure();  // no sample is produced; the estimator integrates across the gap on the next one
+
+    // writes the oldest unused sample to state in g's and in degrees per second; false once all are used
+    bool nextSample();
 
     float getTemp() {
-        return (float)temperatureCount[0] / 333.87 + 21.0;
+        return (float)temperatureCount[0] / 333.87f + 21.0f;
     }
 
     uint8_t getID();
 
-    void setFilters(uint8_t gyrofilter, uint8_t accelfilter);
+    // queues verified writes of the gyro and accel DLPF settings, safe to call while flying;
+    // returns false if a previous change is still in flight or a setting is out of range; gyro settings 0 and 7
+    // run the sensor at 8kHz, which the sample timing cannot follow, so they are out of range too
+    bool setFilters(uint8_t gyrofilter, uint8_t accelfilter);
+    void registerWritten(const I2CRegisterWrite &write, bool success);  // settles a setFilters write
+
+    uint32_t accelDelayMicros() const;  // delay of the on-chip accel DLPF the sensor is known to use
+
+    uint32_t configFailureCount() const {  // setFilters writes the sensor never confirmed
+        return config_failures;
+    }
+
+    // let the MPU's own I2C master sample the AK8963 so every burst read also carries the magnetometer data;
+    // the AK8963 is no longer reachable directly afterwards, so configure it first
+    void attachMagnetometer(AK8963 *mag);
+
+    // drain up to MAX_FIFO_BATCH samples per read from the MPU FIFO once batch_size new samples are waiting,
+    // instead of reading one sample per data-ready edge; call after attachMagnetometer
+    void enableFifo(uint8_t batch_size);
+
+    // lowpass every sample at cutoff_hz and only hand every factor-th one to nextSample, so the estimator can run
+    // slower than the sensor without aliasing; a factor of 1 turns the stage off
+    void setDecimation(uint8_t factor, float cutoff_hz);
+
+    uint32_t sampleMicros() const {  // capture time of the sample last written to state by nextSample
+        return sample_micros;
+    }
+
+    uint32_t lateCount() const {  // samples that waited in the ring longer than a read should take
+        return late_samples;
+    }
+
+    uint32_t droppedCount() const {  // samples lost because the ring was full
+        return samples.droppedCount();
+    }
 
    private:
     State *state;
     I2CManager *i2c;
 
-    bool dataReadyInterrupt();  // check interrupt
+    struct Sample {
+        uint32_t micros;  // capture time
+        int16_t accel[3];  // REGISTER system
+        int16_t gyro[3];
+        uint8_t mag[8];  // AK8963 ST1..ST2 block, if attached
+    };
+
+    enum class ReadStage : uint8_t {
+        Sample,     // one sample from ACCEL_XOUT_H
+        FifoCount,  // FIFO_COUNTH/L
+        FifoData,   // a batch of records from FIFO_R_W
+        FifoReset,  // recovering from a FIFO overflow
+    };
+
+    static void dataReadyISR();
+    bool dataReadyInterrupt();  // check and clear the latched interrupt
+    uint32_t edgeBefore(uint32_t when);  // the newest data-ready edge at or before when
+    bool startFifoRead();
+    void resetFifo();
+    void pushSample(uint32_t capture_micros, const uint8_t *accelData, const uint8_t *gyroData, const uint8_t *magData);
+    void convertSample(const Sample &sample);
+
+    // written by dataReadyISR
+    volatile bool data_ready{false};
+    volatile uint8_t pending_samples{0};
+    volatile uint32_t data_ready_micros{0};
+    // the latest edges: a read that waited on the bus finds a newer sample than the edge that asked for it
+    static const uint8_t EDGE_HISTORY = 8;
+    volatile uint32_t edge_history[EDGE_HISTORY]{0};
+    volatile uint8_t edge_count{0};
+
+    uint32_t edge_micros{0};    // data-ready edge that triggered the read
+    uint32_t newest_micros{0};  // data-ready edge of the newest FIFO sample when FIFO_COUNT was read
+    uint32_t sample_micros{0};
+    uint32_t request_micros{0};
+
+    AK8963 *magnetometer{nullptr};
+
+    ReadStage stage{ReadStage::Sample};
+    uint8_t fifo_batch{0};  // zero while the FIFO is not used
+    uint8_t fifo_record{12};
+    uint8_t fifo_backlog{0};  // samples left in the FIFO after the last batch
+    uint8_t user_ctrl{0};
+
+    // filled from processCallback, drained by nextSample; holds two full FIFO batches
+    SampleRing<Sample, 2 * MAX_FIFO_BATCH> samples;
+    uint32_t late_micros{2 * MPU_SAMPLE_PERIOD};
+    uint32_t late_samples{0};
+
     uint8_t getStatusByte();
 
-    void rotate(float R[3][3], float x[3]);
+    void updateTransforms();  // refold R, biases and scales after any of them change
 
     void reset();
     void configure();  // set up filters and resolutions for flight
 
     float invSqrt(float x);
-    const float aRes = 8.0 / 32768.0;     // +/- 8g
-    const float gRes = 1000.0 / 32768.0;  // +/- 1000 deg/s
+    const float aRes = 8.0f / 32768.0f;     // +/- 8g
+    const float gRes = 1000.0f / 32768.0f;  // +/- 1000 deg/s
 
     // 16-bit raw values, bias correction, factory calibration
     int16_t temperatureCount[1] = {0};
-    int16_t gyroCount[3] = {0, 0, 0}, accelCount[3] = {0, 0, 0};
     float gyroBias[3] = {0.0, 0.0, 0.0}, accelBias[3] = {0.0, 0.0, 0.0};
 
+    // REGISTER values to FLYER system: the left 3x3 block maps axes, signs, scale and R; the last column removes bias
+    float accelTransform[3][4];
+    float gyroTransform[3][4];
+
     // buffers for processCallback
-    uint8_t data_to_read[14];
+    // a single sample is accel, temp, gyro, then the AK8963 ST1..ST2 block from EXT_SENS_DATA_00
+    // FIFO records hold accel, gyro, then the same AK8963 block
+    uint8_t data_to_read[MAX_FIFO_BATCH * 20];
     uint8_t data_to_send[1];
+    uint8_t fifo_count_data[2];
+    uint8_t fifo_reset_data[2];
+
+    // anti-aliasing ahead of decimation
+    Biquad gyro_antialias[3];
+    Biquad accel_antialias[3];
+    uint8_t decimation{1};
+    uint8_t decimation_phase{0};
+
+    uint8_t accel_filter_setting{0};  // only changed once the sensor confirmed it
+    uint32_t config_failures{0};
+    I2CRegisterWrite gyro_filter_write;
+    I2CRegisterWrite accel_filter_write;
 
 };  // class MPU9250
 
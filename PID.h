@@ -87,7 +87,7 @@ class PID {
     }
 
     float Compute(uint32_t now) {
-        float delta_time = (now - last_time) / 1000000.0;
+        float delta_time = (now - last_time) * 0.000001f;
 
         setpoint_ = setpoint_filter.update(desired_setpoint_, delta_time);
 
@@ -4,6 +4,7 @@
     *  License and other details available at: http://www.flybrix.com/firmware
 */
 
+#include "singlePrecision.h"
 #include "R415X.h"
 
 volatile uint16_t RX[RC_CHANNEL_COUNT];  // filled by the interrupt with valid data
@@ -1,6 +1,9 @@
+#include "singlePrecision.h"
 #include "ahrs.h"
 
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
 
 float _inv_sqrt(float x);
 
@@ -70,7 +73,7 @@ void se_madgwick_ahrs_update_imu_with_mag(float gx, float gy, float gz, float ax
         /* Reference direction of Earth's magnetic field */
         hx = mx * q0q0 - _2q0my * q[3] + _2q0mz * q[2] + mx * q1q1 + _2q1 * my * q[2] + _2q1 * mz * q[3] - mx * q2q2 - mx * q3q3;
         hy = _2q0mx * q[3] + my * q0q0 - _2q0mz * q[1] + _2q1mx * q[2] - my * q1q1 + my * q2q2 + _2q2 * mz * q[3] - my * q3q3;
-        _2bx = sqrt(hx * hx + hy * hy);
+        _2bx = sqrtf(hx * hx + hy * hy);
         _2bz = -_2q0mx * q[2] + _2q0my * q[1] + mz * q0q0 + _2q1mx * q[3] - mz * q1q1 + _2q2 * my * q[3] - mz * q2q2 + mz * q3q3;
         _4bx = 2.0f * _2bx;
         _4bz = 2.0f * _2bz;
@@ -235,7 +238,7 @@ void se_mahony_ahrs_update_imu_with_mag(float gx, float gy, float gz, float ax,
         /* Reference direction of Earth's magnetic field */
         hx = 2.0f * (mx * (0.5f - q2q2 - q3q3) + my * (q1q2 - q0q3) + mz * (q1q3 + q0q2));
         hy = 2.0f * (mx * (q1q2 + q0q3) + my * (0.5f - q1q1 - q3q3) + mz * (q2q3 - q0q1));
-        bx = sqrt(hx * hx + hy * hy);
+        bx = sqrtf(hx * hx + hy * hy);
         bz = 2.0f * (mx * (q1q3 - q0q2) + my * (q2q3 + q0q1) + mz * (0.5f - q1q1 - q2q2));
 
         /* Estimated direction of gravity and magnetic field */
@@ -380,9 +383,10 @@ void se_mahony_ahrs_update_imu(float gx, float gy, float gz, float ax, float ay,
 float _inv_sqrt(float x) {
     float halfx = 0.5f * (float)x;
     float y = (float)x;
-    long i = *(long*)&y;
+    int32_t i;
+    memcpy(&i, &y, sizeof(i));  // long is 64 bits off the Teensy, and the pointer cast breaks aliasing rules
     i = 0x5f3759df - (i >> 1);
-    y = *(float*)&i;
+    memcpy(&y, &i, sizeof(y));
     y = y * (1.5f - (halfx * y * y));
     return (float)y;
 }
@@ -390,7 +394,7 @@ float _inv_sqrt(float x) {
 #else
 
 float _inv_sqrt(float x) {
-    return 1.0f / sqrt(x);
+    return 1.0f / sqrtf(x);
 }
 
 #endif
@@ -4,6 +4,7 @@
     *  License and other details available at: http://www.flybrix.com/firmware
 */
 
+#include "singlePrecision.h"
 #include "airframe.h"
 
 #include "config.h"  //CONFIG variable
@@ -0,0 +1,36 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include "singlePrecision.h"
+#include "biquad.h"
+#include <math.h>
+
+Biquad::Biquad() : b0{1.0f}, b1{0.0f}, b2{0.0f}, a1{0.0f}, a2{0.0f} {
+}
+
+Biquad::Biquad(float cutoff_hz, float sample_hz) {
+    // http://www.musicdsp.org/files/Audio-EQ-Cookbook.txt
+    float w0 = 2.0f * (float)M_PI * cutoff_hz / sample_hz;
+    float cos_w0 = cosf(w0);
+    float alpha = sinf(w0) * (float)M_SQRT1_2;  // sin(w0) / (2 * Q)
+    float a0 = 1.0f + alpha;
+    b0 = (1.0f - cos_w0) * 0.5f / a0;
+    b1 = (1.0f - cos_w0) / a0;
+    b2 = b0;
+    a1 = -2.0f * cos_w0 / a0;
+    a2 = (1.0f - alpha) / a0;
+}
+
+void Biquad::reset(float x) {
+    // unity gain at DC, so the steady state output is x
+    z1 = x - b0 * x;
+    z2 = b2 * x - a2 * x;
+}
+
+float Biquad::groupDelay() const {
+    // for H(z) = B(z) / A(z) the delay at DC is sum(k * b_k) / sum(b_k) - sum(k * a_k) / sum(a_k)
+    return (b1 + 2.0f * b2) / (b0 + b1 + b2) - (a1 + 2.0f * a2) / (1.0f + a1 + a2);
+}
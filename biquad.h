@@ -0,0 +1,39 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <biquad.h/cpp>
+
+    Second order IIR filter sections for cleaning up sensor data before it reaches the estimator.
+
+*/
+
+#ifndef biquad_h
+#define biquad_h
+
+#include "Arduino.h"
+
+class Biquad {
+   public:
+    Biquad();  // passes its input through unchanged
+    // Butterworth lowpass (Q = 1/sqrt(2)) from the bilinear transform; needs cutoff_hz below sample_hz / 2
+    Biquad(float cutoff_hz, float sample_hz);
+
+    float apply(float x) {  // direct form II transposed
+        float y = b0 * x + z1;
+        z1 = b1 * x - a1 * y + z2;
+        z2 = b2 * x - a2 * y;
+        return y;
+    }
+
+    void reset(float x);  // settle as if x had been the input forever
+
+    float groupDelay() const;  // at DC, in samples
+
+   private:
+    float b0, b1, b2, a1, a2;  // normalized so a0 = 1
+    float z1{0.0f}, z2{0.0f};
+};
+
+#endif
@@ -8,6 +8,7 @@
 
 */
 
+#include "singlePrecision.h"
 #include "cascadedPID.h"
 
 CascadedPID::CascadedPID(float* master_terms, float* slave_terms)
@@ -1,3 +1,4 @@
+#include "singlePrecision.h"
 #include "cobs.h"
 
 size_t cobsEncode(uint8_t* dst_ptr, const uint8_t* src_begin, const uint8_t* src_end) {
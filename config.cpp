@@ -4,6 +4,7 @@
     *  License and other details available at: http://www.flybrix.com/firmware
 */
 
+#include "singlePrecision.h"
 #include "config.h"
 #include "version.h"
 
@@ -4,9 +4,11 @@
     *  License and other details available at: http://www.flybrix.com/firmware
 */
 
+#include "singlePrecision.h"
 #include "control.h"
 #include "config.h"
 #include "state.h"
+#include "timing.h"
 
 namespace {
 enum PID_ID {
@@ -19,6 +21,65 @@ enum PID_ID {
     ROLL_SLAVE = 6,
     YAW_SLAVE = 7,
 };
+
+// sine and cosine of half an angle given in degrees, within 2e-4 over +/-180 degrees
+void halfAngle(float angle_deg, float& s, float& c) {
+    float x = constrain(angle_deg, -180.0f, 180.0f) * 0.00872664626f;
+    float x2 = x * x;
+    s = x * (1.0f - x2 * (1.0f / 6.0f) * (1.0f - x2 * (1.0f / 20.0f) * (1.0f - x2 * (1.0f / 42.0f))));
+    c = 1.0f - x2 * 0.5f * (1.0f - x2 * (1.0f / 12.0f) * (1.0f - x2 * (1.0f / 30.0f) * (1.0f - x2 * (1.0f / 56.0f))));
+}
+
+void quaternionMultiply(const float a[4], const float b[4], float out[4]) {
+    out[0] = a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3];
+    out[1] = a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2];
+    out[2] = a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1];
+    out[3] = a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0];
+}
+
+}  // namespace
+
+// the commanded attitude is level (a half turn about x) followed by yaw, roll and pitch, which matches kinematicsAngle
+void attitudeError(const float q[4], float pitch_deg, float roll_deg, float yaw_deg, bool hold_heading, float error[3]) {
+    float heading[4]{1.0f, 0.0f, 0.0f, 0.0f};
+    if (hold_heading) {
+        // the current Euler yaw, yaw = -atan2(r31, r32) as in State::kinematicsAngle, so an attitude that already
+        // has the commanded pitch and roll gives no error; its half angle quaternion points along
+        // (1 + cos(yaw), sin(yaw)), i.e. (n + r32, -r31) for n = |(r31, r32)|
+        float r31 = 2.0f * (q[3] * q[0] + q[1] * q[2]);
+        float r32 = q[1] * q[1] - q[2] * q[2] - q[3] * q[3] + q[0] * q[0];
+        float n = sqrtf(r31 * r31 + r32 * r32);
+        float half_sq = 2.0f * n * (n + r32);
+        if (half_sq > 1e-12f) {  // otherwise rolled over by 90 degrees, where yaw is undefined, or turned half way
+            float inv_norm = 1.0f / sqrtf(half_sq);
+            heading[0] = (n + r32) * inv_norm;
+            heading[3] = -r31 * inv_norm;
+        } else if (n > 1e-3f) {
+            heading[0] = 0.0f;
+            heading[3] = 1.0f;
+        }
+    } else {
+        halfAngle(yaw_deg, heading[3], heading[0]);
+    }
+
+    float s_pitch, c_pitch, s_roll, c_roll;
+    halfAngle(pitch_deg, s_pitch, c_pitch);
+    halfAngle(roll_deg, s_roll, c_roll);
+    const float tilt[4]{c_roll * c_pitch, c_roll * s_pitch, s_roll * c_pitch, -s_roll * s_pitch};
+
+    float heading_tilt[4];
+    quaternionMultiply(heading, tilt, heading_tilt);
+
+    // level * heading_tilt, where level is {0, 1, 0, 0}
+    const float command[4]{-heading_tilt[1], heading_tilt[0], -heading_tilt[3], heading_tilt[2]};
+    const float inverse[4]{q[0], -q[1], -q[2], -q[3]};
+    float delta[4];
+    quaternionMultiply(inverse, command, delta);
+
+    // take the short way around; 2 * sin(angle / 2) is close enough to the angle for a proportional loop
+    float scale = (delta[0] < 0.0f ? -2.0f : 2.0f) * 57.2957795f;
+    for (uint8_t i = 0; i < 3; ++i)
+        error[i] = scale * delta[i + 1];
 }
 
 Control::Control(State* __state, CONFIG_struct& config)
@@ -50,20 +111,46 @@ void Control::parseConfig(CONFIG_struct& config) {
     yaw_pid.IntegralReset();
 }
 
+void Control::setAttitudeMode(AttitudeMode mode) {
+    if (mode == attitude_mode)
+        return;
+    attitude_mode = mode;
+    // the master integrals were accumulated against a different error
+    pitch_pid.IntegralReset();
+    roll_pid.IntegralReset();
+    yaw_pid.IntegralReset();
+}
+
 void Control::calculateControlVectors() {
+    ScopedTiming timing(TimingProbe::ControlVectors);
+    float thrust_setpoint = state->command_throttle * (1.0f/4095.0f) * thrust_pid.getScalingFactor(pidEnabled[THRUST_MASTER], pidEnabled[THRUST_SLAVE], 4095.0f);
+    float pitch_setpoint = state->command_pitch * (1.0f/2047.0f) * pitch_pid.getScalingFactor(pidEnabled[PITCH_MASTER], pidEnabled[PITCH_SLAVE], 2047.0f);
+    float roll_setpoint = state->command_roll * (1.0f/2047.0f) * roll_pid.getScalingFactor(pidEnabled[ROLL_MASTER], pidEnabled[ROLL_SLAVE], 2047.0f);
+    float yaw_setpoint = state->command_yaw * (1.0f/2047.0f) * yaw_pid.getScalingFactor(pidEnabled[YAW_MASTER], pidEnabled[YAW_SLAVE], 2047.0f);
+
     thrust_pid.setMasterInput(state->kinematicsAltitude);
     thrust_pid.setSlaveInput(0.0f); //state->kinematicsClimbRate
-    pitch_pid.setMasterInput(state->kinematicsAngle[0] * 57.2957795f);
+    if (attitude_mode == AttitudeMode::QuaternionError && pidEnabled[PITCH_MASTER] && pidEnabled[ROLL_MASTER]) {
+        // present each master with an input that sits exactly the body frame error away from its setpoint,
+        // so the setpoint filters and gains behave as in the Euler mode
+        float error[3];
+        attitudeError(state->kinematicsQuaternion(), pitch_setpoint, roll_setpoint, yaw_setpoint, !pidEnabled[YAW_MASTER], error);
+        pitch_pid.setMasterInput(pitch_setpoint - error[0]);
+        roll_pid.setMasterInput(roll_setpoint - error[1]);
+        yaw_pid.setMasterInput(yaw_setpoint - error[2]);
+    } else {
+        pitch_pid.setMasterInput(state->kinematicsAngle()[0] * 57.2957795f);
+        roll_pid.setMasterInput(state->kinematicsAngle()[1] * 57.2957795f);
+        yaw_pid.setMasterInput(state->kinematicsAngle()[2] * 57.2957795f);
+    }
     pitch_pid.setSlaveInput(state->kinematicsRate[0] * 57.2957795f);
-    roll_pid.setMasterInput(state->kinematicsAngle[1] * 57.2957795f);
     roll_pid.setSlaveInput(state->kinematicsRate[1] * 57.2957795f);
-    yaw_pid.setMasterInput(state->kinematicsAngle[2] * 57.2957795f);
     yaw_pid.setSlaveInput(state->kinematicsRate[2] * 57.2957795f);
 
-    thrust_pid.setSetpoint(state->command_throttle * (1.0f/4095.0f) * thrust_pid.getScalingFactor(pidEnabled[THRUST_MASTER], pidEnabled[THRUST_SLAVE], 4095.0f));
-    pitch_pid.setSetpoint(state->command_pitch * (1.0f/2047.0f) * pitch_pid.getScalingFactor(pidEnabled[PITCH_MASTER], pidEnabled[PITCH_SLAVE], 2047.0f));
-    roll_pid.setSetpoint(state->command_roll * (1.0f/2047.0f) * roll_pid.getScalingFactor(pidEnabled[ROLL_MASTER], pidEnabled[ROLL_SLAVE], 2047.0f));
-    yaw_pid.setSetpoint(state->command_yaw * (1.0f/2047.0f) * yaw_pid.getScalingFactor(pidEnabled[YAW_MASTER], pidEnabled[YAW_SLAVE], 2047.0f));
+    thrust_pid.setSetpoint(thrust_setpoint);
+    pitch_pid.setSetpoint(pitch_setpoint);
+    roll_pid.setSetpoint(roll_setpoint);
+    yaw_pid.setSetpoint(yaw_setpoint);
 
     // compute new output levels for state
     uint32_t now = micros();
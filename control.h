@@ -19,6 +19,10 @@ class PID;
 class CONFIG_struct;
 class State;
 
+// body frame rotation, in degrees about pitch/roll/yaw (x,y,z), that takes attitude q onto the commanded angles;
+// with hold_heading the commanded yaw is ignored and the current one kept
+void attitudeError(const float q[4], float pitch_deg, float roll_deg, float yaw_deg, bool hold_heading, float error[3]);
+
 class Control {
    public:
     Control(State *state, CONFIG_struct& config);
@@ -27,6 +31,15 @@ class Control {
 
     void calculateControlVectors();
 
+    enum class AttitudeMode : uint8_t {
+        Euler,            // master PIDs track the Euler angles as wrapped degrees
+        QuaternionError,  // master PIDs act on the body frame rotation between the attitude and commanded quaternions
+    };
+
+    // the quaternion mode needs the pitch and roll masters enabled and uses the Euler path while either is bypassed;
+    // with the yaw master bypassed the commanded attitude keeps the current heading
+    void setAttitudeMode(AttitudeMode mode);
+
     State *state;
     uint32_t lastUpdateMicros = 0;  // 1.2 hrs should be enough
     
@@ -35,6 +48,9 @@ class Control {
 
     // controllers
     CascadedPID thrust_pid, pitch_pid, roll_pid, yaw_pid;
+
+   private:
+    AttitudeMode attitude_mode{AttitudeMode::Euler};
 };
 
 #endif
@@ -8,6 +8,7 @@
     Utility functions for debugging
 */
 
+#include "singlePrecision.h"
 #include "debug.h"
 #include <Arduino.h>
 #include <vector>
@@ -11,6 +11,31 @@
 
 // #define DEBUG
 
+// run estimator -> controller -> mixer -> PWM only when a new IMU sample arrived;
+// comment out to recompute the control vectors on every loop pass
+#define CONTROL_ON_NEW_SAMPLE
+
+// read the magnetometer through the MPU9250 auxiliary bus, in the same burst as the inertial data
+// #define MAG_THROUGH_MPU
+
+// drain the MPU9250 FIFO in batches of this many samples instead of reading every sample on its own
+// #define IMU_FIFO_BATCH 4
+
+// lowpass the 1kHz IMU stream and run the state update on every IMU_DECIMATION-th sample only
+// #define IMU_DECIMATION 2
+// #define IMU_ANTIALIAS_HZ 100.0f
+
+// software lowpass of the accelerometer behind the 92Hz on-chip filter, tuned per consumer:
+// the attitude correction only needs the gravity direction, vertical acceleration needs to be recent
+#define ACCEL_ATTITUDE_HZ 10.0f
+#define ACCEL_VERTICAL_HZ 30.0f
+
+// drive the pitch/roll/yaw master PIDs from the quaternion attitude error instead of the Euler angles
+// #define ATTITUDE_QUATERNION_CONTROL
+
+// first, so the single precision rule covers every header below as well
+#include "singlePrecision.h"
+
 // library imports
 #include <Arduino.h>
 #include <EEPROM.h>
@@ -33,6 +58,7 @@
 #include "serial.h"
 #include "i2cManager.h"
 #include "localization.h"
+#include "scheduler.h"
 #include "debug.h"
 #include "version.h"
 
@@ -54,6 +80,7 @@ struct Systems {
     PilotCommand pilot;
     Control control;
     SerialComm conf;
+    Scheduler scheduler;
     Systems();
 } sys;
 
@@ -70,10 +97,13 @@ Systems::Systems()
       airframe{&state},
       pilot{&state},
       control{&state, CONFIG.data},
-      conf{&state, RX, &control, &CONFIG, &led}  // listen for configuration inputs
+      conf{&state, RX, &control, &CONFIG, &led, &scheduler, &mpu, &bmp},  // listen for configuration inputs
+      scheduler{}
 {
 }
 
+void registerTasks();
+
 void setup() {
     config_handler = [&](CONFIG_struct& config){
       sys.control.parseConfig(config);
@@ -84,14 +114,16 @@ void setup() {
     // setup USB debug serial
     Serial.begin(9600);  // USB is always 12 Mbit/sec
 
-    // MPU9250 is limited to 400kHz bus speed.
-    Wire.begin(I2C_MASTER, 0x00, I2C_PINS_18_19, I2C_PULLUP_EXT, I2C_RATE_400);  // For I2C pins 18 and 19
+    sys.i2c.begin();
     sys.state.set(STATUS_BOOT);
     sys.led.update();
 
     // load stored settings (this will reinitialize if there is no data in the EEPROM!
     readEEPROM();
     sys.state.resetState();
+#ifdef ATTITUDE_QUATERNION_CONTROL
+    sys.control.setAttitudeMode(Control::AttitudeMode::QuaternionError);
+#endif
 
     sys.state.set(STATUS_BMP_FAIL);
     sys.led.update();
@@ -100,9 +132,9 @@ void setup() {
         sys.state.clear(STATUS_BMP_FAIL);
         // state is unhappy without an initial pressure
         sys.bmp.startMeasurement();  // important; otherwise we'll never set ready!
-        sys.i2c.update();  // write data
-        delay(2);  // wait for data to arrive
-        sys.i2c.update();  // read data
+        while (!sys.bmp.ready)
+            sys.i2c.update();  // write register address, then read data
+        sys.bmp.newSample();
         sys.state.p0 = sys.state.pressure;  // initialize reference pressure
     } else {
         sys.led.update();
@@ -116,19 +148,37 @@ void setup() {
     sys.mag.restart();
     if ((sys.mpu.getID() == 0x71) && (sys.mag.getID() == 0x48)) {
         sys.state.clear(STATUS_MPU_FAIL);
+#ifdef MAG_THROUGH_MPU
+        sys.mpu.attachMagnetometer(&sys.mag);
+#endif
+#ifdef IMU_FIFO_BATCH
+        sys.mpu.enableFifo(IMU_FIFO_BATCH);
+#endif
+#ifdef IMU_DECIMATION
+        sys.mpu.setDecimation(IMU_DECIMATION, IMU_ANTIALIAS_HZ);
+        sys.state.setAccelFilters(ACCEL_ATTITUDE_HZ, ACCEL_VERTICAL_HZ, 1000000.0f / MPU_SAMPLE_PERIOD / IMU_DECIMATION);
+#else
+        sys.state.setAccelFilters(ACCEL_ATTITUDE_HZ, ACCEL_VERTICAL_HZ, 1000000.0f / MPU_SAMPLE_PERIOD);
+#endif
         while (!sys.mpu.startMeasurement()) {
             delay(1);
         };                           // important; otherwise we'll never set ready!
+#ifndef MAG_THROUGH_MPU
         sys.mag.startMeasurement();  // important; otherwise we'll never set ready!
+#endif
     } else {
         sys.led.update();
         while (1)
             ;
     }
 
+    registerTasks();
+
     sys.state.clear(STATUS_BOOT);
     sys.state.set(STATUS_IDLE);
     sys.led.update();
+
+    sys.scheduler.start(micros());
 }
 
 // Main loop variables
@@ -144,26 +194,6 @@ uint32_t pwr_reads = 0;
 
 uint32_t low_battery_counter = 0;
 
-#define DEF_PROCESS_VARIABLES(F) uint32_t iterations_at_##F##Hz = 0;
-
-/* F is target frequency, D is a tuning factor */
-#define RUN_PROCESS(F)                               \
-    iterations_at_##F##Hz = RunProcess<F>(micros()); \
-    sys.i2c.update();
-
-DEF_PROCESS_VARIABLES(1000)
-DEF_PROCESS_VARIABLES(500)
-DEF_PROCESS_VARIABLES(100)
-DEF_PROCESS_VARIABLES(40)
-DEF_PROCESS_VARIABLES(10)
-DEF_PROCESS_VARIABLES(1)
-
-template <uint32_t f>
-uint32_t RunProcess(uint32_t start);
-
-template <uint32_t f>
-bool ProcessTask();
-
 bool skip_state_update = false;
 
 void loop() {
@@ -176,10 +206,19 @@ void loop() {
 
     sys.i2c.update();  // manages a queue of requests for mpu, mag, bmp
 
+#ifdef CONTROL_ON_NEW_SAMPLE
+    bool run_control = false;
+#else
+    bool run_control = true;
+#endif
+
     if (sys.mpu.ready) {
         if (!skip_state_update) {
-            sys.state.updateStateIMU(micros());  // update state as often as we can
-            state_updates++;
+            while (sys.mpu.nextSample()) {  // a FIFO read delivers several samples at once
+                sys.state.updateStateIMU(sys.mpu.sampleMicros());  // update state as often as we can
+                state_updates++;
+                run_control = true;
+            }
         } else {
             interrupt_waits++;
         }
@@ -195,23 +234,31 @@ void loop() {
 
     if (sys.state.is(STATUS_OVERRIDE)) {  // user is changing motor levels using Configurator
         sys.motors.updateAllChannels();
-    } else {
+    } else if (run_control) {  // otherwise the pass is left to the background tasks
         sys.control.calculateControlVectors();
         control_updates++;
 
         sys.airframe.updateMotorsMix();
         sys.motors.updateAllChannels();
+    } else if (!sys.state.is(STATUS_ENABLED)) {  // a disarm has to reach the motors even when the IMU goes quiet
+        sys.motors.updateAllChannels();
     }
 
-    RUN_PROCESS(1000)
-    RUN_PROCESS(500)
-    RUN_PROCESS(500)
-    RUN_PROCESS(100)
-    RUN_PROCESS(40)
-    RUN_PROCESS(10)
-    RUN_PROCESS(1)
+    // at most one background task per pass, so slow tasks cannot push the IMU/control path late
+    sys.scheduler.run(micros());
+
+    // the last sample is already in state, so queue the next read as soon as its data-ready edge has arrived
+    if (sys.mpu.ready && skip_state_update && sys.mpu.startMeasurement()) {
+        mpu_reads++;
+        skip_state_update = false;
+    }
+
+    sys.i2c.update();
 }
 
+template <uint32_t f>
+bool ProcessTask();
+
 uint32_t eeprom_log_start = EEPROM_LOG_START;
 
 template <>
@@ -235,19 +282,24 @@ bool ProcessTask<1000>() {
 template <>
 bool ProcessTask<500>() {
     sys.led.update();  // update quickly to support color dithering
+
+    // fast enough to catch each barometer conversion soon after it ends; most passes find nothing to do
+    if (sys.bmp.ready) {
+        if (sys.bmp.newSample())
+            sys.state.updateStatePT(sys.bmp.sampleMicros());
+        if (sys.bmp.startMeasurement())
+            bmp_reads++;
+    }
+#ifndef MAG_THROUGH_MPU
+    // same for the magnetometer's 100Hz samples
+    if (sys.mag.ready && sys.mag.startMeasurement())
+        mag_reads++;
+#endif
     return true;
 }
 
 template <>
 bool ProcessTask<100>() {
-    if (sys.bmp.ready) {
-        sys.state.updateStatePT(micros());
-        sys.bmp.startMeasurement();
-        bmp_reads++;
-    } else {
-        return false;
-    }
-
     if (sys.state.is(STATUS_CLEAR_MPU_BIAS)) {
         sys.mpu.forgetBiasValues();
         sys.state.clear(STATUS_CLEAR_MPU_BIAS);
@@ -270,8 +322,9 @@ bool ProcessTask<40>() {
     pwr_reads++;
 
     // check for low voltage condition
-    if ( ((1/50)/0.003*1.2/65536 * sys.state.I1_raw ) > 1.0f ){ //if total battery current > 1A
-        if ( ((20.5+226)/20.5*1.2/65536 * sys.state.V0_raw) < 2.8f ) {
+    // I0_raw reads the 0.003 Ohm battery shunt, scaled as in PowerMonitor::getI0, (1/50)/0.003*1.2/65536
+    if ( (0.00012207031f * sys.state.I0_raw ) > 1.0f ){ //if total battery current > 1A
+        if ( ((20.5f+226.0f)/20.5f*1.2f/65536.0f * sys.state.V0_raw) < 2.8f ) {
             low_battery_counter++;
             if ( low_battery_counter > 40 ){
                 sys.state.set(STATUS_BATTERY_LOW);
@@ -282,7 +335,7 @@ bool ProcessTask<40>() {
         }
     }
     else {
-        if ( ((20.5+226)/20.5*1.2/65536 * sys.state.V0_raw) < 3.63f ) {
+        if ( ((20.5f+226.0f)/20.5f*1.2f/65536.0f * sys.state.V0_raw) < 3.63f ) {
             low_battery_counter++;
             if ( low_battery_counter > 40 ){
                 sys.state.set(STATUS_BATTERY_LOW);
@@ -296,22 +349,10 @@ bool ProcessTask<40>() {
     return true;
 }
 
-template <>
-bool ProcessTask<10>() {
-    if (sys.mag.ready) {
-        sys.mag.startMeasurement();
-        mag_reads++;
-    } else {
-        return false;
-    }
-
-    return true;
-}
-
 template <>
 bool ProcessTask<1>() {
 #ifdef DEBUG
-    float elapsed_seconds = (micros() - start_time) / 1000000.0;
+    float elapsed_seconds = (micros() - start_time) / 1000000.0f;
     Serial.print("DEBUG: elapsed time (seconds)   = ");
     Serial.println(elapsed_seconds);
     Serial.print("DEBUG: main loop rate (Hz)      = ");
@@ -321,44 +362,83 @@ bool ProcessTask<1>() {
     Serial.print("DEBUG: control update rate (Hz) = ");
     Serial.println(control_updates / elapsed_seconds);
     Serial.print("DEBUG: mpu read rate (Hz) = ");
-    Serial.println(mpu_reads / elapsed_seconds);
+    Serial.print(mpu_reads / elapsed_seconds);
+    Serial.print(", late samples = ");
+    Serial.print(sys.mpu.lateCount());
+    Serial.print(", dropped = ");
+    Serial.print(sys.mpu.droppedCount());
+    Serial.print(", config failures = ");
+    Serial.println(sys.mpu.configFailureCount());
     Serial.print("DEBUG: mag read rate (Hz) = ");
-    Serial.println(mag_reads / elapsed_seconds);
+    Serial.print(mag_reads / elapsed_seconds);
+    Serial.print(", skipped = ");
+    Serial.print(sys.mag.skippedCount());
+    Serial.print(", stale = ");
+    Serial.println(sys.mag.staleCount());
     Serial.print("DEBUG: bmp read rate (Hz) = ");
-    Serial.println(bmp_reads / elapsed_seconds);
+    Serial.print(bmp_reads / elapsed_seconds);
+    Serial.print(", duplicates = ");
+    Serial.print(sys.bmp.duplicateCount());
+    Serial.print(", config failures = ");
+    Serial.println(sys.bmp.configFailureCount());
     Serial.print("DEBUG: pwr read rate (Hz) = ");
     Serial.println(pwr_reads / elapsed_seconds);
-    Serial.print("DEBUG: 500Hz rate (Hz) = ");
-    Serial.println(iterations_at_500Hz / elapsed_seconds);
-    Serial.print("DEBUG: 100Hz rate (Hz) = ");
-    Serial.println(iterations_at_100Hz / elapsed_seconds);
-    Serial.print("DEBUG:  40Hz rate (Hz) = ");
-    Serial.println(iterations_at_40Hz / elapsed_seconds);
-    Serial.print("DEBUG:  10Hz rate (Hz) = ");
-    Serial.println(iterations_at_10Hz / elapsed_seconds);
-    Serial.print("DEBUG:   1Hz rate (Hz) = ");
-    Serial.println(iterations_at_1Hz / elapsed_seconds);
+    for (uint8_t i = 0; i < sys.scheduler.size(); ++i) {
+        const Scheduler::Task& task = sys.scheduler.task(i);
+        Serial.print("DEBUG: task ");
+        Serial.print(1000000 / task.period);
+        Serial.print("Hz rate (Hz) = ");
+        Serial.print(task.iterations / elapsed_seconds);
+        Serial.print(", overruns = ");
+        Serial.print(task.overruns);
+        Serial.print(", skipped = ");
+        Serial.println(task.skipped);
+    }
+    Serial.print("DEBUG: accel delay (us) attitude = ");
+    Serial.print(sys.mpu.accelDelayMicros() + sys.state.attitudeAccelDelay());
+    Serial.print(", vertical = ");
+    Serial.println(sys.mpu.accelDelayMicros() + sys.state.verticalAccelDelay());
     Serial.print("DEBUG: interrupt wait rate (Hz) = ");
     Serial.println(interrupt_waits / elapsed_seconds);
+    for (uint8_t i = 0; i < uint8_t(I2CPriority::Count); ++i) {
+        Serial.print("DEBUG: i2c priority ");
+        Serial.print(i);
+        Serial.print(" queue high water = ");
+        Serial.print(sys.i2c.transferQueue(I2CPriority(i)).highWater());
+        Serial.print(", overflows = ");
+        Serial.println(sys.i2c.transferQueue(I2CPriority(i)).overflowCount());
+    }
+    Serial.print("DEBUG: i2c preemptions = ");
+    Serial.print(sys.i2c.preemptionCount());
+    Serial.print(", starved transfers = ");
+    Serial.println(sys.i2c.starvationCount());
+    Serial.print("DEBUG: i2c bus recoveries = ");
+    Serial.println(sys.i2c.recoveryCount());
+    for (uint8_t i = 0; i < sys.i2c.deviceCount(); ++i) {
+        const I2CDeviceHealth& device = sys.i2c.deviceHealth(i);
+        Serial.print("DEBUG: i2c device 0x");
+        Serial.print(device.address, HEX);
+        Serial.print(" errors = ");
+        Serial.print(device.errors);
+        Serial.print(", timeouts = ");
+        Serial.print(device.timeouts);
+        Serial.print(", failures = ");
+        Serial.println(device.failures);
+    }
+    Serial.print("DEBUG: i2c bus busy (%) = ");
+    Serial.println(sys.i2c.busyPercent());
     Serial.println("");
 #endif
 
     return true;
 }
 
-template <uint32_t f>
-uint32_t RunProcess(uint32_t start) {
-    static uint32_t previous_time{start};
-    static uint32_t iterations{0};
-
-    while (start - previous_time > 1000000 / f) {
-        if (ProcessTask<f>()) {
-            previous_time += 1000000 / f;
-            ++iterations;
-        } else {
-          break;
-        }
-    }
-
-    return iterations;
+void registerTasks() {
+    // period and phase offset in microseconds; phases keep the slow tasks from being released together
+    // budget is the expected worst case run time in microseconds -- longer runs are counted as overruns
+    sys.scheduler.addTask(ProcessTask<1000>, 1000, 0, 150, Scheduler::CatchUp::Coalesce);
+    sys.scheduler.addTask(ProcessTask<500>, 2000, 500, 250, Scheduler::CatchUp::Skip);
+    sys.scheduler.addTask(ProcessTask<100>, 10000, 1250, 400, Scheduler::CatchUp::Coalesce);
+    sys.scheduler.addTask(ProcessTask<40>, 25000, 3750, 300, Scheduler::CatchUp::Burst);  // enabling counts iterations
+    sys.scheduler.addTask(ProcessTask<1>, 1000000, 8750, 2000, Scheduler::CatchUp::Skip);
 }
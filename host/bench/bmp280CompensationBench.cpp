@@ -0,0 +1,92 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    Accuracy and cost of the three BMP280 pressure compensation modes. Accuracy is against the datasheet's double
+    precision formula over -20 to 60 DegC and 30 to 116 kPa with its example calibration; bmp280Test holds the
+    same comparison to limits. Cost is the driver's per-sample path, processCallback and newSample.
+
+    Host cycles flatter both Int64, whose multiplies and divide are single instructions here, and Float, which
+    runs on the desktop FPU. On the Teensy 3.2 Int32 is all single cycle multiplies and two hardware divides;
+    Int64 inlines its 11 multiplies but calls the library for its one 64 bit divide; Float makes 26 soft-float
+    calls (11 multiplies, 2 divides, 10 adds and 3 conversions), which is likely the slowest of the three.
+
+*/
+
+#include <math.h>
+#include "bench.h"
+#include "BMP280.h"
+#include "bmp280Model.h"
+#include "config.h"
+#include "i2cManager.h"
+#include "sim.h"
+#include "state.h"
+
+namespace {
+
+const int32_t raw_t[] = {380000, 450000, 519888, 580000, 630000};
+const int32_t raw_p[] = {360000, 415148, 480000, 560000, 640000, 720000, 820000};
+
+// the 20 bit readings as the result registers hold them
+void fillRaw(int32_t p, int32_t t, uint8_t data[6]) {
+    data[0] = (uint8_t)(p >> 12);
+    data[1] = (uint8_t)(p >> 4);
+    data[2] = (uint8_t)((p & 0x0F) << 4);
+    data[3] = (uint8_t)(t >> 12);
+    data[4] = (uint8_t)(t >> 4);
+    data[5] = (uint8_t)((t & 0x0F) << 4);
+}
+
+}  // namespace
+
+int main() {
+    initializeEEPROM();
+    sim::setCallCost(0);
+    sim::BMP280Model model;
+    sim::Bus::instance().add(&model);
+    State state;
+    I2CManager i2c;
+    i2c.begin();
+    BMP280 bmp(&state, &i2c);
+    bmp.restart();  // reads the example calibration from the model
+
+    const BMP280::Compensation modes[] = {BMP280::Compensation::Int32, BMP280::Compensation::Int64, BMP280::Compensation::Float};
+    const char *names[] = {"Int32", "Int64", "Float"};
+    const uint32_t points = sizeof(raw_t) / sizeof(raw_t[0]) * sizeof(raw_p) / sizeof(raw_p[0]);
+
+    printf("%-8s %12s %12s\n", "mode", "worst Pa", "rms Pa");
+    for (uint8_t m = 0; m < 3; ++m) {
+        bmp.setCompensation(modes[m]);
+        double worst = 0, squares = 0;
+        uint8_t data[6];
+        for (int32_t t : raw_t) {
+            for (int32_t p : raw_p) {
+                fillRaw(p, t, data);
+                bmp.processCallback(6, data);
+                bmp.newSample();
+                model.setRaw(p, t);
+                double error = state.pressure / 256.0 - model.referencePressure();
+                worst = fmax(worst, fabs(error));
+                squares += error * error;
+            }
+        }
+        printf("%-8s %12.3f %12.3f\n", names[m], worst, sqrt(squares / points));
+    }
+
+    uint8_t inputs[64][6];
+    for (uint32_t i = 0; i < 64; ++i)  // consecutive readings differ, so none is taken for a repeat
+        fillRaw(raw_p[i % 7] + (int32_t)i, raw_t[i % 5], inputs[i]);
+    for (uint8_t m = 0; m < 3; ++m) {
+        bmp.setCompensation(modes[m]);
+        char name[64];
+        snprintf(name, sizeof(name), "processCallback + newSample, %s", names[m]);
+        bench::report(name, bench::measure(1000000, [&](uint32_t i) {
+                          bmp.processCallback(6, inputs[i & 63]);
+                          bmp.newSample();
+                          bench::keep(state.pressure);
+                      }),
+                      "sample");
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    Cost per sample of the IMU anti-aliasing and decimation stage: one Biquad section, the six sections the
+    MPU9250 runs per sample, and the driver's per-sample path with decimation off and at the factors it allows.
+
+    Biquad::apply is 5 multiplies and 4 adds, so 30 and 24 soft-float calls per sample on the Teensy 3.2.
+
+*/
+
+#include "bench.h"
+#include "MPU9250.h"
+#include "biquad.h"
+#include "config.h"
+#include "i2cManager.h"
+#include "sim.h"
+#include "state.h"
+
+namespace {
+
+// a burst from ACCEL_XOUT_H: accel, temperature, gyro
+void fillRaw(uint32_t i, uint8_t raw[14]) {
+    int16_t values[7] = {(int16_t)(1000 + 37 * (i % 97)), (int16_t)(-2000 + 11 * (i % 89)), (int16_t)(4096 - 13 * (i % 83)), 0,
+                         (int16_t)(300 - 7 * (i % 79)), (int16_t)(-50 + 5 * (i % 73)), (int16_t)(20 + 3 * (i % 71))};
+    for (uint8_t k = 0; k < 7; ++k) {
+        raw[2 * k] = (uint8_t)((uint16_t)values[k] >> 8);
+        raw[2 * k + 1] = (uint8_t)values[k];
+    }
+}
+
+}  // namespace
+
+int main() {
+    initializeEEPROM();
+    sim::setCallCost(0);
+
+    float inputs[64];
+    for (uint32_t i = 0; i < 64; ++i)
+        inputs[i] = 0.01f * (float)((i * 37) % 101) - 0.5f;
+
+    Biquad single(80.0f, 1000.0f);
+    bench::report("Biquad::apply", bench::measure(10000000, [&](uint32_t i) { bench::keep(single.apply(inputs[i & 63])); }), "sample");
+
+    Biquad axes[6];
+    for (Biquad &axis : axes)
+        axis = Biquad(80.0f, 1000.0f);
+    float out[6];
+    bench::report("Biquad::apply on 6 axes", bench::measure(1000000, [&](uint32_t i) {
+                      for (uint8_t k = 0; k < 6; ++k)
+                          out[k] = axes[k].apply(inputs[(i + k) & 63]);
+                      bench::keep(out);
+                  }),
+                  "sample");
+
+    uint8_t raw[64][14];
+    for (uint32_t i = 0; i < 64; ++i)
+        fillRaw(i, raw[i]);
+
+    State state;
+    I2CManager i2c;  // processCallback asks it when the burst was read
+    MPU9250 mpu(&state, &i2c);
+    mpu.forgetBiasValues();
+    const uint8_t factors[] = {1, 2, 4, 8};
+    for (uint8_t factor : factors) {
+        mpu.setDecimation(factor, 1000000.0f / MPU_SAMPLE_PERIOD / factor / 2.5f);
+        bench::Result result = bench::measure(1000000, [&](uint32_t i) {
+            mpu.processCallback(14, raw[i & 63]);
+            mpu.nextSample();
+        });
+        printf("MPU9250 sample path, decimation %u %16.1f ns/input %10.1f cycles/input %10.1f cycles/output\n", factor,
+               result.nanoseconds, result.cycles, result.cycles * factor);
+    }
+    return 0;
+}
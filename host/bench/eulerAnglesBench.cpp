@@ -0,0 +1,87 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    Cost per estimator step of deriving the Euler angles from the AHRS quaternion.
+
+    "eager, double" is what updateStateIMU did before the angles became lazy: the conversion on every sample, in
+    atan2 and asin on doubles. "eager, float" is the lazy accessor read after every sample, as the controller does
+    with IMU_FIFO_BATCH and IMU_DECIMATION off. The estimator alone is the floor a step costs when nothing reads the
+    angles, as with ATTITUDE_QUATERNION_CONTROL; with a FIFO batch of N samples it pays one conversion per N.
+
+    On the Teensy 3.2 every double operation is a soft-float call on twice the bits, so the host difference
+    between the two eager rows understates the saving there.
+
+*/
+
+#include <math.h>
+#include "bench.h"
+#include "config.h"
+#include "sim.h"
+#include "state.h"
+
+namespace {
+
+// the conversion as updateStateIMU ran it on every sample
+__attribute__((noinline)) void eulerDouble(const float *q, float angle[3]) {
+    float r11 = 2.0f * (q[2] * q[3] + q[1] * q[0]);
+    float r12 = q[1] * q[1] + q[2] * q[2] - q[3] * q[3] - q[0] * q[0];
+    float r21 = -2.0f * (q[2] * q[0] - q[1] * q[3]);
+    float r31 = 2.0f * (q[3] * q[0] + q[1] * q[2]);
+    float r32 = q[1] * q[1] - q[2] * q[2] - q[3] * q[3] + q[0] * q[0];
+    angle[0] = -atan2(r11, r12);
+    angle[1] = asin(r21);
+    angle[2] = -atan2(r31, r32);
+}
+
+void step(State &state, uint32_t i) {
+    state.gyro[0] = 0.1f * (float)(i % 97) - 4.8f;
+    state.gyro[1] = 0.05f * (float)(i % 89) - 2.2f;
+    state.gyro[2] = 0.02f * (float)(i % 83);
+    state.accel[2] = 1.0f + 0.001f * (float)(i % 79);
+    state.updateStateIMU(i * 1000);
+}
+
+}  // namespace
+
+int main() {
+    initializeEEPROM();
+    sim::setCallCost(0);
+    State state;
+    state.resetState();
+
+    // the two conversions agree, so the rows below compare the same result
+    float angle[3];
+    for (uint32_t i = 0; i < 1000; ++i) {
+        step(state, i);
+        eulerDouble(state.kinematicsQuaternion(), angle);
+        for (uint8_t k = 0; k < 3; ++k) {
+            if (fabsf(angle[k] - state.kinematicsAngle()[k]) > 1e-5f) {
+                printf("float and double conversions differ at step %u\n", i);
+                return 1;
+            }
+        }
+    }
+
+    auto estimator = bench::measure(1000000, [&](uint32_t i) { step(state, i); });
+    auto eager_float = bench::measure(1000000, [&](uint32_t i) {
+        step(state, i);
+        bench::keep(state.kinematicsAngle());
+    });
+    auto eager_double = bench::measure(1000000, [&](uint32_t i) {
+        step(state, i);
+        eulerDouble(state.kinematicsQuaternion(), angle);
+        bench::keep(angle);
+    });
+    bench::report("updateStateIMU, eager, double (before)", eager_double, "step");
+    bench::report("updateStateIMU, eager, float", eager_float, "step");
+    bench::report("updateStateIMU, angles not read", estimator, "step");
+    for (uint32_t batch : {1u, 4u}) {
+        double read = eager_float.nanoseconds - estimator.nanoseconds;
+        double read_cycles = eager_float.cycles - estimator.cycles;
+        printf("saved per step, one read per %u samples: %10.1f ns %10.1f cycles\n", batch,
+               eager_double.nanoseconds - estimator.nanoseconds - read / batch, eager_double.cycles - estimator.cycles - read_cycles / batch);
+    }
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    Host cost of the I2CManager bookkeeping: queueing transfers, an update() with nothing to do, and an
+    update() that finishes one transfer and starts the next. The simulated bus takes no host time, so this is
+    the manager itself; bus time is simulated and reported separately.
+
+*/
+
+#include "bench.h"
+#include "i2cManager.h"
+#include "registerDevice.h"
+#include "sim.h"
+#include "wire.h"
+
+namespace {
+
+class Sink : public CallbackProcessor {
+   public:
+    void processCallback(uint8_t count, uint8_t *data) {
+        ++callbacks;
+    }
+    uint32_t callbacks{0};
+};
+
+}  // namespace
+
+int main() {
+    sim::RegisterDevice device(0x42);
+    sim::Bus::instance().add(&device);
+    sim::setCallCost(0);
+    I2CManager i2c;
+    i2c.begin();
+    Sink sink;
+    uint8_t reg[1]{0};
+    uint8_t data[32];
+
+    bench::report("queue and complete, 8 at a time", bench::measure(100000, [&](uint32_t i) {
+                      i2c.addTransfer(0x42, 1, reg, 14, data, &sink, I2CPriority(i % 3));
+                      if (i % I2CTransferQueue::CAPACITY == I2CTransferQueue::CAPACITY - 1)
+                          while (!i2c.transferQueue(I2CPriority::High).empty() || !i2c.transferQueue(I2CPriority::Medium).empty() ||
+                                 !i2c.transferQueue(I2CPriority::Low).empty()) {
+                              sim::advance(1000);
+                              i2c.update();
+                          }
+                  }),
+                  "transfer");
+
+    bench::report("update, idle", bench::measure(1000000, [&](uint32_t) { i2c.update(); }));
+
+    bench::report("update, transfer on the bus", bench::measure(1000000, [&](uint32_t i) {
+                      if (i == 0)
+                          i2c.addTransfer(0x42, 1, reg, 22, data, &sink, I2CPriority::High);
+                      i2c.update();
+                  }),
+                  "call");
+
+    // every update completes a 22 byte read and starts the next one
+    bench::report("update, finish and restart a 22 byte read", bench::measure(100000, [&](uint32_t) {
+                      i2c.addTransfer(0x42, 1, reg, 22, data, &sink, I2CPriority::High);
+                      sim::advance(1000);
+                      i2c.update();
+                      sim::advance(1000);
+                      i2c.update();
+                  }),
+                  "transfer");
+
+    // mixed load at the flight rates: 1kHz IMU, 100Hz magnetometer, ~26Hz barometer
+    I2CManager flight;
+    flight.begin();
+    sim::setCallCost(1);
+    sim::Bus::instance().clearLog();
+    uint32_t callbacks = sink.callbacks;
+    uint64_t start = sim::now();
+    uint32_t updates = 0;
+    auto mixed = bench::measure(1, [&](uint32_t) {
+        for (uint32_t t = 0; t < 2000000; t += 50) {
+            if (t % 1000 == 0)
+                flight.addTransfer(0x42, 1, reg, 22, data, &sink, I2CPriority::High);
+            if (t % 10000 == 0)
+                flight.addTransfer(0x42, 1, reg, 8, data, &sink, I2CPriority::Medium);
+            if (t % 38000 == 0)
+                flight.addTransfer(0x42, 1, reg, 6, data, &sink, I2CPriority::Low);
+            flight.update();
+            ++updates;
+            sim::advanceTo(start + t + 50);
+        }
+    }, 1);
+    printf("mixed flight load, 2 simulated seconds: %u transfers, %u updates, %.1f ns/update, bus %u%% busy\n",
+           sink.callbacks - callbacks, updates, mixed.nanoseconds / updates, flight.busyPercent());
+    printf("queue high water: high %u, medium %u, low %u; preemptions %u\n", flight.transferQueue(I2CPriority::High).highWater(),
+           flight.transferQueue(I2CPriority::Medium).highWater(), flight.transferQueue(I2CPriority::Low).highWater(), flight.preemptionCount());
+    return 0;
+}
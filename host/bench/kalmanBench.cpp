@@ -0,0 +1,74 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    Cost of the altitude Kalman filter per IMU sample: one predict and one acceleration correct, and the barometer
+    correct on its own. "dense" is the filter before Matrix and SymmetricMatrix, a full 3x3 covariance through
+    the Fgemm_ and Flacpy_ calls in lapack.cpp; "packed" is se_kalman_predict and se_kalman_correct.
+
+*/
+
+#include "bench.h"
+#include "kalman.h"
+#include "kalmanReference.h"
+
+int main() {
+    float dts[64], accelerations[64], elevations[64];
+    for (uint32_t i = 0; i < 64; ++i) {
+        dts[i] = 0.001f + 0.00001f * (float)((i * 37) % 21) - 0.0001f;
+        accelerations[i] = 0.01f * (float)((i * 53) % 101) - 0.5f;
+        elevations[i] = 0.02f * (float)((i * 29) % 61);
+    }
+
+    // the same settled filter for both, so neither is timed on denormals or a 1e30 prior
+    float ref_state[3] = {0.0f, 0.0f, 0.0f};
+    float ref_covar[9] = {1.0f, 0.0f, 0.0f, 0.0f, 0.01f, 0.0f, 0.0f, 0.0f, 0.01f};
+    Matrix<3, 1> state;
+    SymmetricMatrix<3> covar;
+    for (int i = 0; i < 3; ++i)
+        state[i] = 0.0f;
+    for (int j = 0; j < 3; ++j)
+        for (int i = 0; i <= j; ++i)
+            covar(i, j) = ref_covar[i + 3 * j];
+
+    bench::report("dense predict + correct", bench::measure(1000000, [&](uint32_t i) {
+                      referencePredict(dts[i & 63], ref_state, ref_covar);
+                      referenceCorrect(ref_state, ref_covar, A_Z, accelerations[i & 63], ACC_VARIANCE);
+                      if ((i & 31) == 31)
+                          referenceCorrect(ref_state, ref_covar, P_Z, elevations[i & 63], BARO_VARIANCE);  // keeps it bounded
+                      bench::keep(ref_covar);
+                  }),
+                  "sample");
+    bench::report("packed predict + correct", bench::measure(1000000, [&](uint32_t i) {
+                      se_kalman_predict(dts[i & 63], state, covar);
+                      se_kalman_correct(state, covar, A_Z, accelerations[i & 63], ACC_VARIANCE);
+                      if ((i & 31) == 31)
+                          se_kalman_correct(state, covar, P_Z, elevations[i & 63], BARO_VARIANCE);
+                      bench::keep(covar);
+                  }),
+                  "sample");
+    bench::report("dense predict", bench::measure(1000000, [&](uint32_t i) {
+                      referencePredict(dts[i & 63], ref_state, ref_covar);
+                      bench::keep(ref_covar);
+                  }),
+                  "call");
+    bench::report("packed predict", bench::measure(1000000, [&](uint32_t i) {
+                      se_kalman_predict(dts[i & 63], state, covar);
+                      bench::keep(covar);
+                  }),
+                  "call");
+    bench::report("dense correct", bench::measure(1000000, [&](uint32_t i) {
+                      referenceCorrect(ref_state, ref_covar, i & 1 ? A_Z : P_Z, i & 1 ? accelerations[i & 63] : elevations[i & 63],
+                                       i & 1 ? ACC_VARIANCE : BARO_VARIANCE);
+                      bench::keep(ref_covar);
+                  }),
+                  "call");
+    bench::report("packed correct", bench::measure(1000000, [&](uint32_t i) {
+                      se_kalman_correct(state, covar, i & 1 ? A_Z : P_Z, i & 1 ? accelerations[i & 63] : elevations[i & 63],
+                                        i & 1 ? ACC_VARIANCE : BARO_VARIANCE);
+                      bench::keep(covar);
+                  }),
+                  "call");
+    return 0;
+}
@@ -0,0 +1,269 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    Cost per sample of turning MPU9250 register values into FLYER frame accel and gyro readings.
+
+    "separate steps" is the conversion MPU9250 used before the affine transforms: axis and sign mapping, scale and
+    bias per axis, then a rotate() by R for each sensor. "one transform" is the loop in MPU9250::convertSample.
+    Both are checked against the driver's own output first, so neither copy can drift from what it stands for.
+
+    The Teensy 3.2 has no FPU, so every float operation there is a call into the soft-float library; the counts of
+    those per sample are the figure that carries over. Host cycles are reported as well, but a desktop FPU hides
+    most of the difference.
+
+*/
+
+#include <math.h>
+#include <string.h>
+#include "bench.h"
+#include "MPU9250.h"
+#include "config.h"
+#include "i2cManager.h"
+#include "sim.h"
+#include "state.h"
+
+namespace {
+
+// a float that counts the soft-float library calls the Cortex-M4 would make for it
+struct Soft {
+    static uint32_t multiplies, additions, conversions;
+
+    float v;
+    Soft() = default;
+    Soft(float x) : v(x) {
+    }
+    static Soft fromInt(int32_t x) {
+        ++conversions;
+        return Soft((float)x);
+    }
+    Soft operator*(Soft o) const {
+        ++multiplies;
+        return v * o.v;
+    }
+    Soft operator+(Soft o) const {
+        ++additions;
+        return v + o.v;
+    }
+    Soft operator-(Soft o) const {
+        ++additions;
+        return v - o.v;
+    }
+    Soft &operator+=(Soft o) {
+        return *this = *this + o;
+    }
+};
+uint32_t Soft::multiplies = 0, Soft::additions = 0, Soft::conversions = 0;
+
+template <typename T>
+T fromInt(int32_t x);
+template <>
+float fromInt<float>(int32_t x) {
+    return (float)x;
+}
+template <>
+Soft fromInt<Soft>(int32_t x) {
+    return Soft::fromInt(x);
+}
+
+const float aRes = 8.0f / 32768.0f;
+const float gRes = 1000.0f / 32768.0f;
+
+struct Frame {
+    float R[3][3];
+    float accelBias[3];
+    float gyroBias[3];
+    float accelTransform[3][4];
+    float gyroTransform[3][4];
+};
+
+template <typename T>
+void rotate(const float R[3][3], T x[3]) {
+    T y[3] = {0.0f, 0.0f, 0.0f};
+    T sum = 0.0f;
+    for (uint8_t i = 0; i < 3; i++) {
+        sum = 0.0f;
+        for (uint8_t j = 0; j < 3; j++)
+            sum += T(R[i][j]) * x[j];
+        y[i] = sum;
+    }
+    for (uint8_t i = 0; i < 3; i++)
+        x[i] = y[i];
+}
+
+// ACCEL_[XYZ]DIR 0, 1, 2 with signs -1, -1, -1; GYRO_[XYZ]DIR 0, 1, 2 with signs 1, 1, 1
+template <typename T>
+__attribute__((noinline)) void separateSteps(const Frame &f, const uint8_t *accelData, const uint8_t *gyroData, T accel[3], T gyro[3]) {
+    int16_t registerValuesAccel[3];
+    registerValuesAccel[0] = (int16_t)(((uint16_t)accelData[0]) << 8) | (uint16_t)accelData[1];
+    registerValuesAccel[1] = (int16_t)(((uint16_t)accelData[2]) << 8) | (uint16_t)accelData[3];
+    registerValuesAccel[2] = (int16_t)(((uint16_t)accelData[4]) << 8) | (uint16_t)accelData[5];
+    int16_t accelCount[3];
+    accelCount[0] = -1 * registerValuesAccel[0];
+    accelCount[1] = -1 * registerValuesAccel[1];
+    accelCount[2] = -1 * registerValuesAccel[2];
+
+    int16_t registerValuesGyro[3];
+    registerValuesGyro[0] = (int16_t)(((uint16_t)gyroData[0]) << 8) | (uint16_t)gyroData[1];
+    registerValuesGyro[1] = (int16_t)(((uint16_t)gyroData[2]) << 8) | (uint16_t)gyroData[3];
+    registerValuesGyro[2] = (int16_t)(((uint16_t)gyroData[4]) << 8) | (uint16_t)gyroData[5];
+    int16_t gyroCount[3];
+    gyroCount[0] = 1 * registerValuesGyro[0];
+    gyroCount[1] = 1 * registerValuesGyro[1];
+    gyroCount[2] = 1 * registerValuesGyro[2];
+
+    for (uint8_t i = 0; i < 3; i++) {
+        accel[i] = fromInt<T>(accelCount[i]) * T(aRes) - T(f.accelBias[i]);
+        gyro[i] = fromInt<T>(gyroCount[i]) * T(gRes) - T(f.gyroBias[i]);
+    }
+    rotate(f.R, accel);
+    rotate(f.R, gyro);
+}
+
+void prepareTransforms(Frame &f) {
+    const float accelScale[3] = {-aRes, -aRes, -aRes};
+    const float gyroScale[3] = {gRes, gRes, gRes};
+    for (uint8_t i = 0; i < 3; i++) {
+        f.accelTransform[i][3] = 0.0f;
+        f.gyroTransform[i][3] = 0.0f;
+        for (uint8_t j = 0; j < 3; j++) {
+            f.accelTransform[i][j] = f.R[i][j] * accelScale[j];
+            f.gyroTransform[i][j] = f.R[i][j] * gyroScale[j];
+            f.accelTransform[i][3] -= f.R[i][j] * f.accelBias[j];
+            f.gyroTransform[i][3] -= f.R[i][j] * f.gyroBias[j];
+        }
+    }
+}
+
+template <typename T>
+__attribute__((noinline)) void oneTransform(const Frame &f, const uint8_t *accelData, const uint8_t *gyroData, T accel[3], T gyro[3]) {
+    T registerValuesAccel[3];
+    T registerValuesGyro[3];
+    for (uint8_t i = 0; i < 3; i++) {
+        registerValuesAccel[i] = fromInt<T>((int16_t)((((uint16_t)accelData[2 * i]) << 8) | (uint16_t)accelData[2 * i + 1]));
+        registerValuesGyro[i] = fromInt<T>((int16_t)((((uint16_t)gyroData[2 * i]) << 8) | (uint16_t)gyroData[2 * i + 1]));
+    }
+    for (uint8_t i = 0; i < 3; i++) {
+        accel[i] = T(f.accelTransform[i][0]) * registerValuesAccel[0] + T(f.accelTransform[i][1]) * registerValuesAccel[1] +
+                   T(f.accelTransform[i][2]) * registerValuesAccel[2] + T(f.accelTransform[i][3]);
+        gyro[i] = T(f.gyroTransform[i][0]) * registerValuesGyro[0] + T(f.gyroTransform[i][1]) * registerValuesGyro[1] +
+                  T(f.gyroTransform[i][2]) * registerValuesGyro[2] + T(f.gyroTransform[i][3]);
+    }
+}
+
+// a burst from ACCEL_XOUT_H: accel, temperature, gyro
+void fillRaw(uint32_t i, uint8_t raw[14]) {
+    int16_t values[7] = {(int16_t)(1000 + 37 * (i % 97)), (int16_t)(-2000 + 11 * (i % 89)), (int16_t)(4096 - 13 * (i % 83)), 0,
+                         (int16_t)(300 - 7 * (i % 79)), (int16_t)(-50 + 5 * (i % 73)), (int16_t)(20 + 3 * (i % 71))};
+    for (uint8_t k = 0; k < 7; ++k) {
+        raw[2 * k] = (uint8_t)((uint16_t)values[k] >> 8);
+        raw[2 * k + 1] = (uint8_t)values[k];
+    }
+}
+
+// MPU9250::invSqrt, which correctBiasValues normalizes the accel bias with
+float invSqrt(float x) {
+    float halfx = 0.5f * x;
+    float y = x;
+    int32_t i;
+    memcpy(&i, &y, sizeof(i));
+    i = 0x5f3759df - (i >> 1);
+    memcpy(&y, &i, sizeof(y));
+    return y * (1.5f - (halfx * y * y));
+}
+
+bool near(const float a[3], const float b[3]) {
+    for (uint8_t i = 0; i < 3; ++i)
+        if (fabsf(a[i] - b[i]) > 1e-4f * (1.0f + fabsf(b[i])))
+            return false;
+    return true;
+}
+
+template <typename Kernel>
+void countSoftFloat(const char *name, Kernel kernel) {
+    Soft::multiplies = Soft::additions = Soft::conversions = 0;
+    uint8_t raw[14];
+    fillRaw(0, raw);
+    Soft accel[3], gyro[3];
+    kernel(raw, accel, gyro);
+    printf("%-48s %4u multiplies %4u adds %4u int to float\n", name, Soft::multiplies, Soft::additions, Soft::conversions);
+}
+
+}  // namespace
+
+int main() {
+    initializeEEPROM();
+    sim::setCallCost(0);
+    State state;
+    I2CManager i2c;  // processCallback asks it when the burst was read
+    MPU9250 mpu(&state, &i2c);
+
+    // a board tilted by ~10 degrees with a little accel and gyro bias, so R, the biases and the signs all matter
+    state.accel_filter[0] = 0.17f;
+    state.accel_filter[1] = -0.05f;
+    state.accel_filter[2] = -1.01f;
+    state.gyro_filter[0] = 0.5f;
+    state.gyro_filter[1] = -0.3f;
+    state.gyro_filter[2] = 0.2f;
+    mpu.correctBiasValues();
+
+    Frame frame;
+    float recipNorm = invSqrt(state.accel_filter[0] * state.accel_filter[0] + state.accel_filter[1] * state.accel_filter[1] +
+                              state.accel_filter[2] * state.accel_filter[2]);
+    for (uint8_t i = 0; i < 3; ++i) {
+        for (uint8_t j = 0; j < 3; ++j)
+            frame.R[i][j] = state.R[i][j];
+        frame.accelBias[i] = state.accel_filter[i] - state.accel_filter[i] * recipNorm;
+        frame.gyroBias[i] = state.gyro_filter[i];
+    }
+    prepareTransforms(frame);
+
+    uint8_t raw[14];
+    float accel[3], gyro[3];
+    for (uint32_t i = 0; i < 1000; ++i) {
+        fillRaw(i, raw);
+        mpu.processCallback(14, raw);
+        mpu.nextSample();
+        separateSteps(frame, raw, raw + 8, accel, gyro);
+        if (!near(state.accel, accel) || !near(state.gyro, gyro)) {
+            printf("separate steps differ from MPU9250 at sample %u\n", i);
+            return 1;
+        }
+        oneTransform(frame, raw, raw + 8, accel, gyro);
+        if (!near(state.accel, accel) || !near(state.gyro, gyro)) {
+            printf("one transform differs from MPU9250 at sample %u\n", i);
+            return 1;
+        }
+    }
+
+    countSoftFloat("separate steps (before), per sample", [&](const uint8_t *r, Soft *a, Soft *g) { separateSteps(frame, r, r + 8, a, g); });
+    countSoftFloat("one transform (after), per sample", [&](const uint8_t *r, Soft *a, Soft *g) { oneTransform(frame, r, r + 8, a, g); });
+
+    uint8_t inputs[64][14];
+    for (uint32_t i = 0; i < 64; ++i)
+        fillRaw(i, inputs[i]);
+
+    bench::report("separate steps (before)", bench::measure(1000000, [&](uint32_t i) {
+                      const uint8_t *r = inputs[i & 63];
+                      separateSteps(frame, r, r + 8, accel, gyro);
+                      bench::keep(accel);
+                      bench::keep(gyro);
+                  }),
+                  "sample");
+    bench::report("one transform (after)", bench::measure(1000000, [&](uint32_t i) {
+                      const uint8_t *r = inputs[i & 63];
+                      oneTransform(frame, r, r + 8, accel, gyro);
+                      bench::keep(accel);
+                      bench::keep(gyro);
+                  }),
+                  "sample");
+
+    // the whole per-sample path of the driver, ring buffer and timing probe included
+    bench::report("MPU9250 processCallback + nextSample", bench::measure(1000000, [&](uint32_t i) {
+                      mpu.processCallback(14, inputs[i & 63]);
+                      mpu.nextSample();
+                  }),
+                  "sample");
+    return 0;
+}
@@ -0,0 +1,197 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    What the single precision literals and libm calls save in the code that runs on every sample: the three IIRs
+    per axis at the top of State::updateStateIMU, the time step of PID::Compute, and the magnetic field magnitude
+    in the AHRS updates with a magnetometer. Each kernel is written once and instantiated in double, the way the
+    expressions used to promote, and in float, the way they read now.
+
+    The Teensy 3.2 has no FPU, so every operation below is a soft-float library call there, and a double call
+    costs roughly twice a float one on top of the conversions in and out; the counts per call are the figure that
+    carries over. Host cycles are reported as well, but a desktop FPU hides most of the difference.
+
+*/
+
+#include <math.h>
+#include "bench.h"
+#include "PID.h"
+#include "ahrs.h"
+
+namespace {
+
+// a number of precision T that counts the soft-float library calls the Cortex-M4 would make for it
+template <typename T>
+struct Soft {
+    static uint32_t calls;
+
+    T v;
+    Soft operator*(Soft o) const {
+        ++calls;
+        return {v * o.v};
+    }
+    Soft operator/(Soft o) const {
+        ++calls;
+        return {v / o.v};
+    }
+    Soft operator+(Soft o) const {
+        ++calls;
+        return {v + o.v};
+    }
+};
+template <typename T>
+uint32_t Soft<T>::calls = 0;
+uint32_t conversions = 0;  // float and integer to double and back
+
+template <typename R>
+R literal(double x) {
+    return R(x);
+}
+template <typename R>
+R fromFloat(float x) {
+    return R(x);
+}
+template <typename R>
+R fromInt(uint32_t x) {
+    return R(x);
+}
+inline float toFloat(float x) {
+    return x;
+}
+inline float toFloat(double x) {
+    return (float)x;
+}
+inline float root(float x) {
+    return sqrtf(x);
+}
+inline double root(double x) {
+    return sqrt(x);
+}
+
+template <>
+Soft<float> literal<Soft<float>>(double x) {
+    return {(float)x};
+}
+template <>
+Soft<double> literal<Soft<double>>(double x) {
+    return {x};
+}
+template <>
+Soft<float> fromFloat<Soft<float>>(float x) {
+    return {x};
+}
+template <>
+Soft<double> fromFloat<Soft<double>>(float x) {
+    ++conversions;
+    return {x};
+}
+template <>
+Soft<float> fromInt<Soft<float>>(uint32_t x) {
+    ++conversions;
+    return {(float)x};
+}
+template <>
+Soft<double> fromInt<Soft<double>>(uint32_t x) {
+    ++conversions;
+    return {(double)x};
+}
+inline float toFloat(Soft<float> x) {
+    return x.v;
+}
+inline float toFloat(Soft<double> x) {
+    ++conversions;
+    return (float)x.v;
+}
+template <typename T>
+Soft<T> root(Soft<T> x) {
+    ++Soft<T>::calls;
+    return {root(x.v)};
+}
+
+// State::updateStateIMU: gyro_filter[i] = 0.1 * gyro[i] + 0.9 * gyro_filter[i] and so on
+template <typename R>
+__attribute__((noinline)) void stateFilters(const float gyro[3], const float accel[3], float gyro_filter[3], float accel_filter[3],
+                                            float accel_filter_sq[3]) {
+    for (int i = 0; i < 3; i++) {
+        gyro_filter[i] = toFloat(literal<R>(0.1) * fromFloat<R>(gyro[i]) + literal<R>(0.9) * fromFloat<R>(gyro_filter[i]));
+        accel_filter[i] = toFloat(literal<R>(0.1) * fromFloat<R>(accel[i]) + literal<R>(0.9) * fromFloat<R>(accel_filter[i]));
+        accel_filter_sq[i] = toFloat(literal<R>(0.1) * fromFloat<R>(accel[i]) * fromFloat<R>(accel[i]) + literal<R>(0.9) * fromFloat<R>(accel_filter_sq[i]));
+    }
+}
+
+// PID::Compute: (now - last_time) / 1000000.0 before, (now - last_time) * 0.000001f now
+template <typename R>
+__attribute__((noinline)) float timeStepDivided(uint32_t now, uint32_t last_time) {
+    return toFloat(fromInt<R>(now - last_time) / literal<R>(1000000.0));
+}
+template <typename R>
+__attribute__((noinline)) float timeStepScaled(uint32_t now, uint32_t last_time) {
+    return toFloat(fromInt<R>(now - last_time) * literal<R>(0.000001));
+}
+
+// se_madgwick_ahrs_update_imu_with_mag and the Mahony twin: _2bx = sqrt(hx * hx + hy * hy), the sum in float
+template <typename R>
+__attribute__((noinline)) float fieldMagnitude(float hx, float hy) {
+    return toFloat(root(fromFloat<R>(hx * hx + hy * hy)));
+}
+
+template <typename Kernel>
+void countSoftFloat(const char *name, Kernel kernel) {
+    Soft<float>::calls = Soft<double>::calls = conversions = 0;
+    kernel();
+    printf("%-48s %4u float %4u double %4u conversions\n", name, Soft<float>::calls, Soft<double>::calls, conversions);
+}
+
+}  // namespace
+
+int main() {
+    float gyro[64][3], accel[64][3];
+    for (uint32_t i = 0; i < 64; ++i) {
+        for (uint8_t k = 0; k < 3; ++k) {
+            gyro[i][k] = 0.37f * (float)((i * 7 + k * 13) % 29) - 5.0f;
+            accel[i][k] = 0.01f * (float)((i * 11 + k * 5) % 23) + (k == 2 ? -1.0f : 0.0f);
+        }
+    }
+    float gyro_filter[3]{}, accel_filter[3]{}, accel_filter_sq[3]{};
+
+    countSoftFloat("state IIRs, double (before)", [&] { stateFilters<Soft<double>>(gyro[0], accel[0], gyro_filter, accel_filter, accel_filter_sq); });
+    countSoftFloat("state IIRs, float (after)", [&] { stateFilters<Soft<float>>(gyro[0], accel[0], gyro_filter, accel_filter, accel_filter_sq); });
+    countSoftFloat("PID time step, double divide (before)", [&] { bench::keep(timeStepDivided<Soft<double>>(2000, 1000)); });
+    countSoftFloat("PID time step, float multiply (after)", [&] { bench::keep(timeStepScaled<Soft<float>>(2000, 1000)); });
+    countSoftFloat("AHRS field magnitude, double (before)", [&] { bench::keep(fieldMagnitude<Soft<double>>(0.3f, 0.4f)); });
+    countSoftFloat("AHRS field magnitude, float (after)", [&] { bench::keep(fieldMagnitude<Soft<float>>(0.3f, 0.4f)); });
+
+    bench::report("state IIRs, double (before)", bench::measure(1000000, [&](uint32_t i) {
+                      stateFilters<double>(gyro[i & 63], accel[i & 63], gyro_filter, accel_filter, accel_filter_sq);
+                      bench::keep(accel_filter_sq);
+                  }),
+                  "sample");
+    bench::report("state IIRs, float (after)", bench::measure(1000000, [&](uint32_t i) {
+                      stateFilters<float>(gyro[i & 63], accel[i & 63], gyro_filter, accel_filter, accel_filter_sq);
+                      bench::keep(accel_filter_sq);
+                  }),
+                  "sample");
+
+    bench::report("PID time step, double divide (before)", bench::measure(1000000, [&](uint32_t i) { bench::keep(timeStepDivided<double>(i * 1000 + (i & 7), i * 1000 - 1000)); }));
+    bench::report("PID time step, float multiply (after)", bench::measure(1000000, [&](uint32_t i) { bench::keep(timeStepScaled<float>(i * 1000 + (i & 7), i * 1000 - 1000)); }));
+    // the whole controller step the time step is part of, for scale
+    float terms[7]{1.0f, 0.5f, 0.02f, 100.0f, 0.005f, 0.005f, 1.0f};
+    PID pid(terms);
+    bench::report("PID::Compute", bench::measure(1000000, [&](uint32_t i) {
+                      pid.setInput(gyro[i & 63][0]);
+                      bench::keep(pid.Compute(i * 1000 + 1000));
+                  }));
+
+    bench::report("AHRS field magnitude, double (before)", bench::measure(1000000, [&](uint32_t i) { bench::keep(fieldMagnitude<double>(gyro[i & 63][0], gyro[i & 63][1])); }));
+    bench::report("AHRS field magnitude, float (after)", bench::measure(1000000, [&](uint32_t i) { bench::keep(fieldMagnitude<float>(gyro[i & 63][0], gyro[i & 63][1])); }));
+    float q[4]{1.0f, 0.0f, 0.0f, 0.0f}, fb_i[3]{0.0f, 0.0f, 0.0f};
+    bench::report("se_mahony_ahrs_update_imu_with_mag", bench::measure(1000000, [&](uint32_t i) {
+                      const float *g = gyro[i & 63], *a = accel[i & 63];
+                      se_mahony_ahrs_update_imu_with_mag(0.01f * g[0], 0.01f * g[1], 0.01f * g[2], a[0], a[1], a[2], 0.3f, 0.1f, -0.4f, 0.001f, 0.0f,
+                                                         1.0f, fb_i, q);
+                      bench::keep(q);
+                  }),
+                  "sample");
+    return 0;
+}
@@ -0,0 +1,105 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include "ak8963Model.h"
+
+namespace sim {
+
+AK8963Model::AK8963Model() : RegisterDevice(ADDRESS) {
+    powerOn();
+}
+
+void AK8963Model::powerOn() {
+    for (uint16_t reg = 0; reg < 256; ++reg)
+        registers[reg] = 0;
+    registers[WIA] = 0x48;
+    registers[0x01] = 0x9A;  // INFO, undocumented content
+    next_measurement = IDLE;
+}
+
+void AK8963Model::setField(int16_t x, int16_t y, int16_t z) {
+    field[0] = x;
+    field[1] = y;
+    field[2] = z;
+}
+
+void AK8963Model::setAdjustment(uint8_t x, uint8_t y, uint8_t z) {
+    adjustment[0] = x;
+    adjustment[1] = y;
+    adjustment[2] = z;
+}
+
+uint8_t AK8963Model::readRegister(uint8_t reg) {
+    if (reg >= ASAX && reg < ASAX + 3)  // the fuse ROM only shows in fuse ROM access mode
+        return (registers[CNTL1] & 0x0F) == 0x0F ? adjustment[reg - ASAX] : 0;
+    uint8_t value = registers[reg];
+    if (reg >= HXL && reg <= ST2)  // reading the data releases it; DRDY and DOR clear
+        registers[ST1] &= ~0x03;
+    return value;
+}
+
+void AK8963Model::writeRegister(uint8_t reg, uint8_t value) {
+    switch (reg) {
+        case CNTL1:
+            registers[CNTL1] = value;
+            switch (value & 0x0F) {
+                case 0x01:
+                    next_measurement = now() + SINGLE_MEASUREMENT;
+                    break;
+                case 0x02:
+                    next_measurement = now() + MODE1_PERIOD;
+                    break;
+                case 0x06:
+                    next_measurement = now() + MODE2_PERIOD;
+                    break;
+                default:  // power down, self test and fuse ROM access do not measure here
+                    next_measurement = IDLE;
+                    break;
+            }
+            break;
+        case CNTL2:
+            if (value & 0x01)  // SRST
+                powerOn();
+            break;
+        case 0x0C:  // ASTC
+        case 0x0F:  // I2CDIS
+            registers[reg] = value;
+            break;
+        default:  // everything else is read only
+            break;
+    }
+}
+
+void AK8963Model::runEvent(uint64_t time) {
+    measure();
+    last_measurement = time;
+    switch (registers[CNTL1] & 0x0F) {
+        case 0x01:  // back to power down after a single measurement
+            registers[CNTL1] &= 0xF0;
+            next_measurement = IDLE;
+            break;
+        case 0x02:
+            next_measurement = time + MODE1_PERIOD;
+            break;
+        default:
+            next_measurement = time + MODE2_PERIOD;
+            break;
+    }
+}
+
+void AK8963Model::measure() {
+    ++measurements;
+    if (registers[ST1] & 0x01)  // the previous sample was never read
+        registers[ST1] |= 0x02;
+    registers[ST1] |= 0x01;
+    for (uint8_t i = 0; i < 3; ++i) {  // little endian
+        registers[HXL + 2 * i] = (uint8_t)(field[i] & 0xFF);
+        registers[HXL + 2 * i + 1] = (uint8_t)((uint16_t)field[i] >> 8);
+    }
+    registers[ST2] = registers[CNTL1] & 0x10;  // BITM mirrors the output width, HOFL stays clear
+}
+
+}  // namespace sim
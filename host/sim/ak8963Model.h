@@ -0,0 +1,80 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <ak8963Model.h/cpp>
+
+    AK8963 magnetometer model: WHO_AM_I 0x48, fuse ROM sensitivity, single and continuous measurement modes with
+    ST1 DRDY/DOR and ST2 flags. Reachable on the main bus only while the MPU9250 bypass is open.
+
+*/
+
+#ifndef sim_ak8963Model_h
+#define sim_ak8963Model_h
+
+#include <functional>
+#include "registerDevice.h"
+#include "sim.h"
+
+namespace sim {
+
+class AK8963Model : public RegisterDevice, public Process {
+   public:
+    static const uint8_t ADDRESS = 0x0C;
+
+    static const uint8_t WIA = 0x00;
+    static const uint8_t ST1 = 0x02;
+    static const uint8_t HXL = 0x03;
+    static const uint8_t ST2 = 0x09;
+    static const uint8_t CNTL1 = 0x0A;
+    static const uint8_t CNTL2 = 0x0B;
+    static const uint8_t ASAX = 0x10;
+
+    static const uint32_t MODE1_PERIOD = 125000;  // microseconds, 8Hz
+    static const uint32_t MODE2_PERIOD = 10000;   // 100Hz
+    static const uint32_t SINGLE_MEASUREMENT = 7200;
+
+    AK8963Model();
+
+    bool present() const override {
+        return !gate || gate();
+    }
+    void setGate(std::function<bool()> reachable) {
+        gate = reachable;
+    }
+
+    void setField(int16_t x, int16_t y, int16_t z);  // raw counts in REGISTER coordinates
+    void setAdjustment(uint8_t x, uint8_t y, uint8_t z);  // fuse ROM ASA values; 128 means a gain of 1
+
+    uint32_t measurementCount() const {
+        return measurements;
+    }
+    uint64_t lastMeasurement() const {
+        return last_measurement;
+    }
+
+    uint64_t nextEvent() const override {
+        return next_measurement;
+    }
+    void runEvent(uint64_t time) override;
+
+   protected:
+    uint8_t readRegister(uint8_t reg) override;
+    void writeRegister(uint8_t reg, uint8_t value) override;
+
+   private:
+    void powerOn();
+    void measure();
+
+    std::function<bool()> gate;
+    int16_t field[3]{0, 0, 0};
+    uint8_t adjustment[3]{128, 128, 128};
+    uint64_t next_measurement{IDLE};
+    uint64_t last_measurement{0};
+    uint32_t measurements{0};
+};
+
+}  // namespace sim
+
+#endif
@@ -0,0 +1,144 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include "bmp280Model.h"
+
+namespace sim {
+
+const uint16_t BMP280Model::EXAMPLE_CALIBRATION[12] = {
+    27504, 26435, (uint16_t)-1000, 36477, (uint16_t)-10685, 3024, 2855, 140, (uint16_t)-7, 15500, (uint16_t)-14600, 6000,
+};
+
+BMP280Model::BMP280Model() : RegisterDevice(ADDRESS) {
+    setCalibration(EXAMPLE_CALIBRATION);
+    powerOn();
+}
+
+void BMP280Model::powerOn() {
+    for (uint16_t reg = CALIBRATION + 24; reg < 256; ++reg)
+        registers[reg] = 0;
+    registers[ID] = 0x58;
+    storeResult(PRESS_MSB, 0x80000);  // reset value of the result registers
+    storeResult(TEMP_MSB, 0x80000);
+    next_conversion = IDLE;
+}
+
+void BMP280Model::setCalibration(const uint16_t __calibration[12]) {
+    for (uint8_t i = 0; i < 12; ++i) {  // little endian
+        calibration[i] = __calibration[i];
+        registers[CALIBRATION + 2 * i] = (uint8_t)(calibration[i] & 0xFF);
+        registers[CALIBRATION + 2 * i + 1] = (uint8_t)(calibration[i] >> 8);
+    }
+}
+
+void BMP280Model::setRaw(int32_t __raw_p, int32_t __raw_t) {
+    raw_p = __raw_p;
+    raw_t = __raw_t;
+}
+
+void BMP280Model::setPressureStep(int32_t step) {
+    pressure_step = step;
+}
+
+void BMP280Model::setIgnoreConfigInNormalMode(bool ignore) {
+    ignore_config = ignore;
+}
+
+double BMP280Model::referencePressure() const {
+    double T1 = calibration[0], T2 = (int16_t)calibration[1], T3 = (int16_t)calibration[2];
+    double P1 = calibration[3], P[10];
+    for (uint8_t i = 2; i <= 9; ++i)
+        P[i] = (int16_t)calibration[i + 2];
+    double var1 = ((double)raw_t / 16384.0 - T1 / 1024.0) * T2;
+    double var2 = ((double)raw_t / 131072.0 - T1 / 8192.0) * ((double)raw_t / 131072.0 - T1 / 8192.0) * T3;
+    int32_t t_fine = (int32_t)(var1 + var2);
+    var1 = ((double)t_fine / 2.0) - 64000.0;
+    var2 = var1 * var1 * P[6] / 32768.0;
+    var2 = var2 + var1 * P[5] * 2.0;
+    var2 = (var2 / 4.0) + (P[4] * 65536.0);
+    var1 = (P[3] * var1 * var1 / 524288.0 + P[2] * var1) / 524288.0;
+    var1 = (1.0 + var1 / 32768.0) * P1;
+    if (var1 == 0.0)
+        return 0;
+    double p = 1048576.0 - (double)raw_p;
+    p = (p - (var2 / 4096.0)) * 6250.0 / var1;
+    var1 = P[9] * p * p / 2147483648.0;
+    var2 = p * P[8] / 32768.0;
+    return p + (var1 + var2 + P[7]) / 16.0;
+}
+
+uint32_t BMP280Model::measurementTime() const {
+    // datasheet section 3.8.1: 1 + 2 * T oversampling + (2 * P oversampling + 0.5) milliseconds, typical
+    uint8_t osrs_t = (registers[CTRL_MEAS] >> 5) & 0x07;
+    uint8_t osrs_p = (registers[CTRL_MEAS] >> 2) & 0x07;
+    uint32_t time = 1000;
+    if (osrs_t)
+        time += 2000 * (1 << (osrs_t < 5 ? osrs_t - 1 : 4));
+    if (osrs_p)
+        time += 2000 * (1 << (osrs_p < 5 ? osrs_p - 1 : 4)) + 500;
+    return time;
+}
+
+uint32_t BMP280Model::standbyTime() const {
+    static const uint32_t standby[8] = {500, 62500, 125000, 250000, 500000, 1000000, 2000000, 4000000};
+    return standby[registers[CONFIG] >> 5];
+}
+
+void BMP280Model::writeRegister(uint8_t reg, uint8_t value) {
+    switch (reg) {
+        case RESET:
+            if (value == 0xB6)
+                powerOn();
+            return;
+        case CTRL_MEAS: {
+            bool was_normal = (registers[CTRL_MEAS] & 0x03) == 0x03;
+            registers[CTRL_MEAS] = value;
+            switch (value & 0x03) {
+                case 0x00:
+                    next_conversion = IDLE;
+                    break;
+                case 0x03:
+                    if (!was_normal)  // otherwise the running cycle continues with the new settings
+                        next_conversion = now() + measurementTime();
+                    break;
+                default:  // forced
+                    next_conversion = now() + measurementTime();
+                    break;
+            }
+            return;
+        }
+        case CONFIG:
+            if (ignore_config && (registers[CTRL_MEAS] & 0x03) == 0x03)
+                return;
+            registers[CONFIG] = value;
+            return;
+        default:
+            return;  // everything else is read only
+    }
+}
+
+void BMP280Model::runEvent(uint64_t time) {
+    ++conversions;
+    last_conversion = time;
+    result_p = raw_p;
+    storeResult(PRESS_MSB, raw_p);
+    storeResult(TEMP_MSB, raw_t);
+    raw_p += pressure_step;
+    if ((registers[CTRL_MEAS] & 0x03) == 0x03) {
+        next_conversion = time + standbyTime() + measurementTime();
+    } else {  // a forced conversion returns to sleep
+        registers[CTRL_MEAS] &= ~0x03;
+        next_conversion = IDLE;
+    }
+}
+
+void BMP280Model::storeResult(uint8_t reg, int32_t raw) {
+    registers[reg] = (uint8_t)(raw >> 12);
+    registers[reg + 1] = (uint8_t)(raw >> 4);
+    registers[reg + 2] = (uint8_t)((raw & 0x0F) << 4);
+}
+
+}  // namespace sim
@@ -0,0 +1,91 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <bmp280Model.h/cpp>
+
+    BMP280 model: chip id 0x58, factory calibration at 0x88, results at 0xF7, and sleep/forced/normal mode
+    conversions with the datasheet's typical measurement and standby times. The calibration and raw readings
+    default to the compensation example of the datasheet (section 8.2).
+
+*/
+
+#ifndef sim_bmp280Model_h
+#define sim_bmp280Model_h
+
+#include "registerDevice.h"
+#include "sim.h"
+
+namespace sim {
+
+class BMP280Model : public RegisterDevice, public Process {
+   public:
+    static const uint8_t ADDRESS = 0x77;
+
+    static const uint8_t CALIBRATION = 0x88;
+    static const uint8_t ID = 0xD0;
+    static const uint8_t RESET = 0xE0;
+    static const uint8_t STATUS = 0xF3;
+    static const uint8_t CTRL_MEAS = 0xF4;
+    static const uint8_t CONFIG = 0xF5;
+    static const uint8_t PRESS_MSB = 0xF7;
+    static const uint8_t TEMP_MSB = 0xFA;
+
+    // datasheet compensation example: 25.08 DegC and 100653.27 Pa (its formulas give 100653.25 Pa)
+    static const uint16_t EXAMPLE_CALIBRATION[12];
+    static const int32_t EXAMPLE_RAW_T = 519888;
+    static const int32_t EXAMPLE_RAW_P = 415148;
+
+    BMP280Model();
+
+    void setCalibration(const uint16_t calibration[12]);  // dig_T1..dig_P9, as stored
+    void setRaw(int32_t raw_p, int32_t raw_t);
+    void setPressureStep(int32_t step);  // added to the raw pressure after every conversion, so results differ
+    // the datasheet allows the chip to ignore CONFIG writes in normal mode; off by default
+    void setIgnoreConfigInNormalMode(bool ignore);
+
+    // datasheet section 8.1 double precision compensation of the current raw readings, in Pa; the reference the
+    // driver's integer and single precision formulas are measured against
+    double referencePressure() const;
+
+    uint32_t measurementTime() const;  // microseconds, typical, for the current oversampling
+    uint32_t standbyTime() const;
+
+    uint32_t conversionCount() const {
+        return conversions;
+    }
+    uint64_t lastConversion() const {  // when the latest result reached the data registers
+        return last_conversion;
+    }
+    int32_t lastRawPressure() const {
+        return result_p;
+    }
+
+    uint64_t nextEvent() const override {
+        return next_conversion;
+    }
+    void runEvent(uint64_t time) override;
+
+   protected:
+    void writeRegister(uint8_t reg, uint8_t value) override;
+
+   private:
+    void powerOn();
+    void storeResult(uint8_t reg, int32_t raw);
+
+    uint16_t calibration[12];
+    int32_t raw_p{EXAMPLE_RAW_P};
+    int32_t raw_t{EXAMPLE_RAW_T};
+    int32_t result_p{0};
+    int32_t pressure_step{0};
+    bool ignore_config{false};
+
+    uint64_t next_conversion{IDLE};
+    uint64_t last_conversion{0};
+    uint32_t conversions{0};
+};
+
+}  // namespace sim
+
+#endif
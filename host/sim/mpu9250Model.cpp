@@ -0,0 +1,227 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include "mpu9250Model.h"
+
+namespace sim {
+
+MPU9250Model::MPU9250Model(uint8_t interrupt_pin) : RegisterDevice(ADDRESS), pin(interrupt_pin) {
+    powerOn();
+    next_sample = phase;
+}
+
+void MPU9250Model::powerOn() {
+    for (uint16_t reg = 0; reg < 256; ++reg)
+        registers[reg] = 0;
+    registers[REG_PWR_MGMT_1] = 0x01;
+    registers[REG_WHO_AM_I] = 0x71;
+    fifo.clear();
+}
+
+void MPU9250Model::setMotion(Motion __motion) {
+    motion = __motion;
+}
+
+void MPU9250Model::setAccel(int16_t x, int16_t y, int16_t z) {
+    accel[0] = x;
+    accel[1] = y;
+    accel[2] = z;
+}
+
+void MPU9250Model::setGyro(int16_t x, int16_t y, int16_t z) {
+    gyro[0] = x;
+    gyro[1] = y;
+    gyro[2] = z;
+}
+
+void MPU9250Model::setTemperature(int16_t raw) {
+    temperature = raw;
+}
+
+void MPU9250Model::setSamplePhase(uint32_t us) {
+    phase = us;
+    uint64_t period = samplePeriod();
+    uint64_t time = now();
+    next_sample = time <= phase ? phase : phase + ((time - phase) / period + 1) * period;
+}
+
+void MPU9250Model::attachAuxiliary(RegisterDevice *device) {
+    aux = device;
+}
+
+bool MPU9250Model::bypassOpen() const {
+    // BYPASS_EN connects the auxiliary pins to the main bus, unless the MPU's own master drives them
+    return (registers[REG_INT_PIN_CFG] & 0x02) && !(registers[REG_USER_CTRL] & 0x20);
+}
+
+uint32_t MPU9250Model::samplePeriod() const {
+    // the gyro DLPF settings 0 and 7 run the internal rate at 8kHz, all others at 1kHz
+    uint8_t dlpf = registers[REG_CONFIG] & 0x07;
+    uint32_t internal = (dlpf == 0 || dlpf == 7) ? 125 : 1000;
+    return internal * (1 + registers[REG_SMPLRT_DIV]);
+}
+
+void MPU9250Model::runEvent(uint64_t time) {
+    next_sample = time + samplePeriod();
+    if (registers[REG_PWR_MGMT_1] & 0x40)  // SLEEP
+        return;
+
+    int16_t sample_accel[3] = {accel[0], accel[1], accel[2]};
+    int16_t sample_gyro[3] = {gyro[0], gyro[1], gyro[2]};
+    if (motion)
+        motion(samples, time, sample_accel, sample_gyro);
+    ++samples;
+    last_sample = time;
+
+    for (uint8_t i = 0; i < 3; ++i) {  // big endian
+        registers[REG_ACCEL_XOUT_H + 2 * i] = (uint8_t)((uint16_t)sample_accel[i] >> 8);
+        registers[REG_ACCEL_XOUT_H + 2 * i + 1] = (uint8_t)(sample_accel[i] & 0xFF);
+        registers[REG_GYRO_XOUT_H + 2 * i] = (uint8_t)((uint16_t)sample_gyro[i] >> 8);
+        registers[REG_GYRO_XOUT_H + 2 * i + 1] = (uint8_t)(sample_gyro[i] & 0xFF);
+    }
+    registers[REG_TEMP_OUT_H] = (uint8_t)((uint16_t)temperature >> 8);
+    registers[REG_TEMP_OUT_H + 1] = (uint8_t)(temperature & 0xFF);
+
+    if (registers[REG_USER_CTRL] & 0x20)  // I2C_MST_EN
+        runAuxiliary();
+
+    if (registers[REG_USER_CTRL] & 0x40) {  // REG_FIFO_EN; records are written in register order
+        uint8_t enable = registers[REG_FIFO_EN];
+        if (enable & 0x08)
+            pushFifo(&registers[REG_ACCEL_XOUT_H], 6);
+        if (enable & 0x80)
+            pushFifo(&registers[REG_TEMP_OUT_H], 2);
+        for (uint8_t axis = 0; axis < 3; ++axis)
+            if (enable & (0x40 >> axis))
+                pushFifo(&registers[REG_GYRO_XOUT_H + 2 * axis], 2);
+        if (enable & 0x01)
+            pushFifo(&registers[REG_EXT_SENS_DATA_00], registers[REG_I2C_SLV0_CTRL] & 0x0F);
+    }
+
+    registers[REG_INT_STATUS] |= 0x01;  // RAW_DATA_RDY_INT
+    if (registers[REG_INT_ENABLE] & 0x01)
+        raise(pin);
+}
+
+void MPU9250Model::runAuxiliary() {
+    uint8_t slv0 = registers[REG_I2C_SLV0_ADDR];
+    if (registers[REG_I2C_SLV0_CTRL] & 0x80) {
+        uint8_t count = registers[REG_I2C_SLV0_CTRL] & 0x0F;
+        if (aux && aux->address() == (slv0 & 0x7F)) {
+            uint8_t reg = registers[REG_I2C_SLV0_REG];
+            aux->write(&reg, 1);
+            if (slv0 & 0x80) {
+                aux->read(&registers[REG_EXT_SENS_DATA_00], count);
+            } else {
+                uint8_t data[2] = {reg, registers[REG_I2C_SLV0_DO]};
+                aux->write(data, 2);
+            }
+        } else {
+            registers[REG_I2C_MST_STATUS] |= 0x01;  // I2C_SLV0_NACK
+        }
+    }
+
+    // SLV4 does one transfer per request and clears its enable bit when done
+    uint8_t slv4 = registers[REG_I2C_SLV4_ADDR];
+    if (registers[REG_I2C_SLV4_CTRL] & 0x80) {
+        registers[REG_I2C_SLV4_CTRL] &= ~0x80;
+        if (aux && aux->address() == (slv4 & 0x7F)) {
+            uint8_t reg = registers[REG_I2C_SLV4_REG];
+            if (slv4 & 0x80) {
+                aux->write(&reg, 1);
+                aux->read(&registers[REG_I2C_SLV4_DI], 1);
+            } else {
+                uint8_t data[2] = {reg, registers[REG_I2C_SLV4_DO]};
+                aux->write(data, 2);
+                ++aux_writes;
+            }
+            registers[REG_I2C_MST_STATUS] |= 0x40;  // I2C_SLV4_DONE
+        } else {
+            registers[REG_I2C_MST_STATUS] |= 0x50;  // I2C_SLV4_DONE, I2C_SLV4_NACK
+        }
+    }
+}
+
+void MPU9250Model::pushFifo(const uint8_t *data, uint8_t count) {
+    for (uint8_t i = 0; i < count; ++i) {
+        if (fifo.size() == FIFO_SIZE) {  // the oldest byte is overwritten, records lose their alignment
+            fifo.pop_front();
+            if (!(registers[REG_INT_STATUS] & 0x10))
+                ++overflows;
+            registers[REG_INT_STATUS] |= 0x10;  // FIFO_OFLOW_INT
+        }
+        fifo.push_back(data[i]);
+    }
+}
+
+uint8_t MPU9250Model::readRegister(uint8_t reg) {
+    switch (reg) {
+        case REG_FIFO_COUNTH:
+            return (uint8_t)(fifo.size() >> 8);
+        case REG_FIFO_COUNTL:
+            return (uint8_t)(fifo.size() & 0xFF);
+        case REG_FIFO_R_W: {
+            if (fifo.empty())
+                return 0xFF;
+            uint8_t value = fifo.front();
+            fifo.pop_front();
+            return value;
+        }
+        case REG_INT_STATUS: {
+            uint8_t value = registers[REG_INT_STATUS];
+            registers[REG_INT_STATUS] = 0;
+            return value;
+        }
+        case REG_I2C_MST_STATUS: {
+            uint8_t value = registers[REG_I2C_MST_STATUS];
+            registers[REG_I2C_MST_STATUS] = 0;
+            return value;
+        }
+        default:
+            return registers[reg];
+    }
+}
+
+void MPU9250Model::writeRegister(uint8_t reg, uint8_t value) {
+    switch (reg) {
+        case REG_PWR_MGMT_1:
+            if (value & 0x80) {  // H_RESET clears itself
+                powerOn();
+                return;
+            }
+            registers[REG_PWR_MGMT_1] = value;
+            return;
+        case REG_USER_CTRL:
+            if (value & 0x04)  // FIFO_RST clears itself
+                fifo.clear();
+            registers[REG_USER_CTRL] = value & ~0x07;
+            return;
+        case REG_SMPLRT_DIV:
+        case REG_CONFIG:
+            registers[reg] = value;
+            setSamplePhase(phase);
+            return;
+        case REG_I2C_MST_STATUS:
+        case REG_INT_STATUS:
+        case REG_FIFO_COUNTH:
+        case REG_FIFO_COUNTL:
+        case REG_FIFO_R_W:
+        case REG_WHO_AM_I:
+        case REG_I2C_SLV4_DI:
+            return;  // read only
+        default:
+            if (reg >= REG_ACCEL_XOUT_H && reg < REG_I2C_SLV0_DO)
+                return;  // sensor and external sensor data are read only
+            registers[reg] = value;
+            return;
+    }
+}
+
+uint8_t MPU9250Model::nextRegister(uint8_t reg) const {
+    return reg == REG_FIFO_R_W ? reg : reg + 1;  // a burst from REG_FIFO_R_W keeps draining the FIFO
+}
+
+}  // namespace sim
@@ -0,0 +1,124 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <mpu9250Model.h/cpp>
+
+    MPU9250 model: REG_WHO_AM_I 0x71, accel/temp/gyro burst from REG_ACCEL_XOUT_H, a data-ready pulse per sample, the
+    512 byte FIFO, and the auxiliary I2C master (SLV0 reads into EXT_SENS_DATA, SLV4 single transfers) in
+    front of an attached AK8963 model.
+
+*/
+
+#ifndef sim_mpu9250Model_h
+#define sim_mpu9250Model_h
+
+#include <deque>
+#include <functional>
+#include "registerDevice.h"
+#include "sim.h"
+
+namespace sim {
+
+class MPU9250Model : public RegisterDevice, public Process {
+   public:
+    static const uint8_t ADDRESS = 0x68;
+    static const uint16_t FIFO_SIZE = 512;
+
+    // prefixed so they stay clear of the #defines in MPU9250.h
+    static const uint8_t REG_SMPLRT_DIV = 0x19;
+    static const uint8_t REG_CONFIG = 0x1A;
+    static const uint8_t REG_ACCEL_CONFIG2 = 0x1D;
+    static const uint8_t REG_FIFO_EN = 0x23;
+    static const uint8_t REG_I2C_SLV0_ADDR = 0x25;
+    static const uint8_t REG_I2C_SLV0_REG = 0x26;
+    static const uint8_t REG_I2C_SLV0_CTRL = 0x27;
+    static const uint8_t REG_I2C_SLV4_ADDR = 0x31;
+    static const uint8_t REG_I2C_SLV4_REG = 0x32;
+    static const uint8_t REG_I2C_SLV4_DO = 0x33;
+    static const uint8_t REG_I2C_SLV4_CTRL = 0x34;
+    static const uint8_t REG_I2C_SLV4_DI = 0x35;
+    static const uint8_t REG_I2C_MST_STATUS = 0x36;
+    static const uint8_t REG_INT_PIN_CFG = 0x37;
+    static const uint8_t REG_INT_ENABLE = 0x38;
+    static const uint8_t REG_INT_STATUS = 0x3A;
+    static const uint8_t REG_ACCEL_XOUT_H = 0x3B;
+    static const uint8_t REG_TEMP_OUT_H = 0x41;
+    static const uint8_t REG_GYRO_XOUT_H = 0x43;
+    static const uint8_t REG_EXT_SENS_DATA_00 = 0x49;
+    static const uint8_t REG_I2C_SLV0_DO = 0x63;
+    static const uint8_t REG_USER_CTRL = 0x6A;
+    static const uint8_t REG_PWR_MGMT_1 = 0x6B;
+    static const uint8_t REG_FIFO_COUNTH = 0x72;
+    static const uint8_t REG_FIFO_COUNTL = 0x73;
+    static const uint8_t REG_FIFO_R_W = 0x74;
+    static const uint8_t REG_WHO_AM_I = 0x75;
+
+    // fills in the REGISTER values of sample number index, taken at time
+    using Motion = std::function<void(uint32_t index, uint64_t time, int16_t accel[3], int16_t gyro[3])>;
+
+    explicit MPU9250Model(uint8_t interrupt_pin);
+
+    void setMotion(Motion motion);
+    void setAccel(int16_t x, int16_t y, int16_t z);  // constant motion
+    void setGyro(int16_t x, int16_t y, int16_t z);
+    void setTemperature(int16_t raw);
+    void setSamplePhase(uint32_t us);  // samples are taken at phase + k * period
+
+    // the AK8963 sits on the auxiliary bus: reachable directly only through the bypass, otherwise via SLV0/SLV4
+    void attachAuxiliary(RegisterDevice *device);
+    bool bypassOpen() const;
+
+    uint32_t sampleCount() const {
+        return samples;
+    }
+    uint64_t lastSample() const {
+        return last_sample;
+    }
+    uint32_t samplePeriod() const;  // microseconds, from the DLPF and REG_SMPLRT_DIV settings
+    uint16_t fifoCount() const {
+        return (uint16_t)fifo.size();
+    }
+    uint32_t fifoOverflows() const {
+        return overflows;
+    }
+    uint32_t auxiliaryWrites() const {  // SLV4 writes that reached the auxiliary device
+        return aux_writes;
+    }
+
+    uint64_t nextEvent() const override {
+        return next_sample;
+    }
+    void runEvent(uint64_t time) override;
+
+   protected:
+    uint8_t readRegister(uint8_t reg) override;
+    void writeRegister(uint8_t reg, uint8_t value) override;
+    uint8_t nextRegister(uint8_t reg) const override;
+
+   private:
+    void powerOn();
+    void runAuxiliary();
+    void pushFifo(const uint8_t *data, uint8_t count);
+
+    uint8_t pin;
+    Motion motion;
+    int16_t accel[3]{0, 0, 0};
+    int16_t gyro[3]{0, 0, 0};
+    int16_t temperature{0};
+    uint32_t phase{0};
+    uint64_t next_sample{0};
+    uint64_t last_sample{0};
+    uint32_t samples{0};
+
+    RegisterDevice *aux{nullptr};
+    uint32_t aux_writes{0};
+
+    std::deque<uint8_t> fifo;
+    uint32_t overflows{0};
+};
+
+}  // namespace sim
+
+#endif
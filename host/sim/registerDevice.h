@@ -0,0 +1,74 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <registerDevice.h>
+
+    Base of the sensor models: a register file behind an auto-incrementing register pointer. The first byte of
+    a write sets the pointer, the rest are stored from there on; reads continue from the pointer.
+
+*/
+
+#ifndef sim_registerDevice_h
+#define sim_registerDevice_h
+
+#include "wire.h"
+
+namespace sim {
+
+class RegisterDevice : public I2CDevice {
+   public:
+    explicit RegisterDevice(uint8_t address) : device_address(address) {
+    }
+
+    uint8_t address() const override {
+        return device_address;
+    }
+
+    void write(const uint8_t *data, size_t count) override {
+        if (!count)
+            return;
+        pointer = data[0];
+        for (size_t i = 1; i < count; ++i) {
+            writeRegister(pointer, data[i]);
+            pointer = nextRegister(pointer);
+        }
+    }
+
+    void read(uint8_t *data, size_t count) override {
+        for (size_t i = 0; i < count; ++i) {
+            data[i] = readRegister(pointer);
+            pointer = nextRegister(pointer);
+        }
+    }
+
+    // direct access for the tests, without side effects
+    uint8_t peek(uint8_t reg) const {
+        return registers[reg];
+    }
+    void poke(uint8_t reg, uint8_t value) {
+        registers[reg] = value;
+    }
+
+   protected:
+    virtual uint8_t readRegister(uint8_t reg) {
+        return registers[reg];
+    }
+    virtual void writeRegister(uint8_t reg, uint8_t value) {
+        registers[reg] = value;
+    }
+    virtual uint8_t nextRegister(uint8_t reg) const {
+        return reg + 1;
+    }
+
+    uint8_t registers[256]{0};
+
+   private:
+    uint8_t device_address;
+    uint8_t pointer{0};
+};
+
+}  // namespace sim
+
+#endif
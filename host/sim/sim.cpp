@@ -0,0 +1,261 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include "sim.h"
+
+#include <Arduino.h>
+#include <ADC.h>
+#include <EEPROM.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+usb_serial_class Serial;
+EEPROMClass EEPROM;
+
+namespace sim {
+namespace {
+const uint8_t PIN_COUNT = 64;
+
+uint64_t time_now{0};
+uint32_t call_cost{1};
+bool in_event{false};
+
+std::vector<Process *> processes;
+
+void (*handlers[PIN_COUNT])(void){nullptr};
+bool pending_edge[PIN_COUNT]{false};
+bool pin_low[PIN_COUNT]{false};
+bool interrupts_enabled{true};
+
+uint16_t analog[PIN_COUNT]{0};
+
+std::deque<uint8_t> serial_in;
+std::string serial_out;
+
+void runHandler(uint8_t pin) {
+    if (!handlers[pin])
+        return;
+    if (!interrupts_enabled) {
+        pending_edge[pin] = true;
+        return;
+    }
+    pending_edge[pin] = false;
+    handlers[pin]();
+}
+
+Process *nextDue(uint64_t until) {
+    Process *next{nullptr};
+    uint64_t next_time = Process::IDLE;
+    for (Process *process : processes) {
+        uint64_t time = process->nextEvent();
+        if (time <= until && time < next_time) {
+            next = process;
+            next_time = time;
+        }
+    }
+    return next;
+}
+}  // namespace
+
+uint64_t now() {
+    return time_now;
+}
+
+void setTime(uint64_t time) {
+    time_now = time;
+}
+
+void advance(uint64_t us) {
+    advanceTo(time_now + us);
+}
+
+void advanceTo(uint64_t time) {
+    if (in_event) {  // an event handler waiting on the bus; nothing else may run in between
+        time_now = std::max(time_now, time);
+        return;
+    }
+    in_event = true;
+    while (Process *process = nextDue(time)) {
+        time_now = std::max(time_now, process->nextEvent());
+        process->runEvent(time_now);
+    }
+    time_now = std::max(time_now, time);
+    in_event = false;
+}
+
+void setCallCost(uint32_t us) {
+    call_cost = us;
+}
+
+void attach(Process *process) {
+    processes.push_back(process);
+}
+
+void detach(Process *process) {
+    processes.erase(std::remove(processes.begin(), processes.end(), process), processes.end());
+}
+
+void raise(uint8_t pin) {
+    if (pin < PIN_COUNT)
+        runHandler(pin);
+}
+
+void setPinLevel(uint8_t pin, bool high) {
+    if (pin < PIN_COUNT)
+        pin_low[pin] = !high;
+}
+
+bool interruptsEnabled() {
+    return interrupts_enabled;
+}
+
+void setAnalog(uint8_t pin, uint16_t value) {
+    if (pin < PIN_COUNT)
+        analog[pin] = value;
+}
+
+void serialInput(const uint8_t *data, size_t length) {
+    serial_in.insert(serial_in.end(), data, data + length);
+}
+
+const std::string &serialOutput() {
+    return serial_out;
+}
+
+void clearSerialOutput() {
+    serial_out.clear();
+}
+
+void reset() {
+    time_now = 0;
+    call_cost = 1;
+    in_event = false;
+    processes.clear();
+    for (uint8_t pin = 0; pin < PIN_COUNT; ++pin) {
+        handlers[pin] = nullptr;
+        pending_edge[pin] = false;
+        pin_low[pin] = false;
+        analog[pin] = 0;
+    }
+    interrupts_enabled = true;
+    serial_in.clear();
+    serial_out.clear();
+}
+
+}  // namespace sim
+
+uint32_t micros() {
+    uint32_t value = (uint32_t)sim::time_now;
+    if (sim::call_cost)
+        sim::advance(sim::call_cost);
+    return value;
+}
+
+uint32_t millis() {
+    return micros() / 1000;
+}
+
+void delay(uint32_t ms) {
+    sim::advance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us) {
+    sim::advance(us);
+}
+
+void pinMode(uint8_t, uint8_t) {
+}
+
+void digitalWrite(uint8_t, uint8_t) {
+}
+
+void digitalWriteFast(uint8_t, uint8_t) {
+}
+
+uint8_t digitalRead(uint8_t pin) {
+    return pin < sim::PIN_COUNT && sim::pin_low[pin] ? LOW : HIGH;
+}
+
+void analogWrite(uint8_t, int) {
+}
+
+void analogWriteFrequency(uint8_t, float) {
+}
+
+void analogWriteResolution(uint32_t) {
+}
+
+void attachInterrupt(uint8_t pin, void (*function)(void), int) {
+    if (pin < sim::PIN_COUNT)
+        sim::handlers[pin] = function;
+}
+
+void detachInterrupt(uint8_t pin) {
+    if (pin < sim::PIN_COUNT) {
+        sim::handlers[pin] = nullptr;
+        sim::pending_edge[pin] = false;
+    }
+}
+
+void noInterrupts() {
+    sim::interrupts_enabled = false;
+}
+
+void interrupts() {
+    sim::interrupts_enabled = true;
+    for (uint8_t pin = 0; pin < sim::PIN_COUNT; ++pin)
+        if (sim::pending_edge[pin])
+            sim::runHandler(pin);
+}
+
+int ADC::analogRead(uint8_t pin, int8_t) {
+    return pin < sim::PIN_COUNT ? sim::analog[pin] : 0;
+}
+
+int usb_serial_class::available() {
+    return (int)sim::serial_in.size();
+}
+
+int usb_serial_class::read() {
+    if (sim::serial_in.empty())
+        return -1;
+    uint8_t b = sim::serial_in.front();
+    sim::serial_in.pop_front();
+    return b;
+}
+
+size_t usb_serial_class::write(uint8_t b) {
+    sim::serial_out += (char)b;
+    return 1;
+}
+
+size_t usb_serial_class::write(const uint8_t *buffer, size_t size) {
+    sim::serial_out.append((const char *)buffer, size);
+    return size;
+}
+
+size_t usb_serial_class::print(const char *text) {
+    return write((const uint8_t *)text, strlen(text));
+}
+
+size_t usb_serial_class::print(long n, int base) {
+    char text[24];
+    snprintf(text, sizeof(text), base == HEX ? "%lX" : "%ld", n);
+    return print(text);
+}
+
+size_t usb_serial_class::print(unsigned long n, int base) {
+    char text[24];
+    snprintf(text, sizeof(text), base == HEX ? "%lX" : "%lu", n);
+    return print(text);
+}
+
+size_t usb_serial_class::print(double n, int digits) {
+    char text[48];
+    snprintf(text, sizeof(text), "%.*f", digits, n);
+    return print(text);
+}
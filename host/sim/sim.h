@@ -0,0 +1,60 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <sim.h/cpp>
+
+    Simulated time, pins and interrupts behind the host Arduino.h.
+
+*/
+
+#ifndef sim_h
+#define sim_h
+
+#include <stdint.h>
+#include <string>
+
+namespace sim {
+
+// anything that acts on its own at simulated times: sensor conversions, data-ready pulses
+class Process {
+   public:
+    static const uint64_t IDLE = UINT64_MAX;
+
+    virtual ~Process() {
+    }
+    virtual uint64_t nextEvent() const = 0;  // absolute time of the next event, or IDLE
+    virtual void runEvent(uint64_t time) = 0;
+};
+
+// time is kept in 64 bits from the start of the simulation; micros() returns its low 32 bits, so it wraps like
+// the real counter does after ~71.6 minutes
+uint64_t now();
+void setTime(uint64_t time);  // jumps without running the events in between; for uptime and wrap tests
+void advance(uint64_t us);    // runs every event that falls due on the way, in time order
+void advanceTo(uint64_t time);
+
+// every micros() call also takes this long, so the flight code's polling loops make progress; 1us by default
+void setCallCost(uint32_t us);
+
+void attach(Process *process);
+void detach(Process *process);
+
+// a rising edge on pin: runs the attachInterrupt handler right away, or once interrupts are enabled again
+void raise(uint8_t pin);
+void setPinLevel(uint8_t pin, bool high);  // what digitalRead returns; pins read high by default
+bool interruptsEnabled();
+
+void setAnalog(uint8_t pin, uint16_t value);
+
+void serialInput(const uint8_t *data, size_t length);
+const std::string &serialOutput();
+void clearSerialOutput();
+
+// forget all processes, handlers, pins and serial data and restart time at 0
+void reset();
+
+}  // namespace sim
+
+#endif
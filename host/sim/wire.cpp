@@ -0,0 +1,211 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include "wire.h"
+
+#include <i2c_t3.h>
+#include "sim.h"
+
+i2c_t3 Wire;
+
+namespace sim {
+
+Bus &Bus::instance() {
+    static Bus bus;
+    return bus;
+}
+
+void Bus::add(I2CDevice *device) {
+    devices.push_back(device);
+}
+
+void Bus::reset() {
+    *this = Bus();
+}
+
+void Bus::setTiming(uint32_t __overhead_ns, uint32_t __byte_ns) {
+    overhead_ns = __overhead_ns;
+    byte_ns = __byte_ns;
+}
+
+uint64_t Bus::duration(size_t count) const {
+    return (overhead_ns + (uint64_t)(count + 1) * byte_ns + 999) / 1000;
+}
+
+void Bus::injectNak(uint8_t address, uint32_t count) {
+    nak_address = address;
+    naks = count;
+}
+
+void Bus::injectArbitrationLoss(uint32_t count) {
+    arbitration_losses = count;
+}
+
+void Bus::injectStall(uint32_t count) {
+    stalls = count;
+}
+
+I2CDevice *Bus::find(uint8_t address) const {
+    for (I2CDevice *device : devices)
+        if (device->address() == address && device->present())
+            return device;
+    return nullptr;
+}
+
+Bus::Result Bus::transact(uint8_t address, bool is_read, uint8_t *data, size_t count, uint64_t &end) {
+    uint64_t start = now();
+    Result result = Result::Ok;
+    I2CDevice *device = find(address);
+    if (stalls) {
+        --stalls;
+        result = Result::Stalled;
+    } else if (arbitration_losses) {
+        --arbitration_losses;
+        result = Result::ArbitrationLost;
+    } else if (naks && address == nak_address) {
+        --naks;
+        result = Result::AddressNak;
+    } else if (!device) {
+        result = Result::AddressNak;
+    }
+
+    switch (result) {
+        case Result::Ok:
+            if (is_read)
+                device->read(data, count);
+            else
+                device->write(data, count);
+            end = start + duration(count);
+            break;
+        case Result::AddressNak:
+        case Result::ArbitrationLost:
+            end = start + duration(0);
+            break;
+        case Result::Stalled:
+            end = UINT64_MAX;
+            break;
+    }
+    transactions.push_back({address, is_read, (uint8_t)count, start, end, result});
+    return result;
+}
+
+void Bus::released() {
+    ++begins;
+}
+
+}  // namespace sim
+
+namespace {
+// the transfer running in the background, as i2c_t3 tracks it in its interrupt handler
+struct Background {
+    bool receiving{false};
+    uint64_t end{0};
+    sim::Bus::Result result{sim::Bus::Result::Ok};
+} background;
+
+i2c_status finalStatus(sim::Bus::Result result) {
+    switch (result) {
+        case sim::Bus::Result::Ok:
+            return I2C_WAITING;
+        case sim::Bus::Result::AddressNak:
+            return I2C_ADDR_NAK;
+        case sim::Bus::Result::ArbitrationLost:
+            return I2C_ARB_LOST;
+        case sim::Bus::Result::Stalled:
+            break;
+    }
+    return I2C_TIMEOUT;
+}
+}  // namespace
+
+void i2c_t3::begin(i2c_mode, uint8_t, i2c_pins, i2c_pullup, i2c_rate) {
+    background = Background();
+    tx_count = 0;
+    rx_count = 0;
+    rx_index = 0;
+    sim::Bus::instance().released();
+}
+
+void i2c_t3::beginTransmission(uint8_t address) {
+    tx_address = address;
+    tx_count = 0;
+}
+
+size_t i2c_t3::write(uint8_t data) {
+    if (tx_count == I2C_TX_BUFFER_LENGTH)
+        return 0;
+    tx_buffer[tx_count++] = data;
+    return 1;
+}
+
+size_t i2c_t3::write(const uint8_t *data, size_t count) {
+    size_t written = 0;
+    while (written < count && write(data[written]))
+        ++written;
+    return written;
+}
+
+uint8_t i2c_t3::endTransmission(i2c_stop) {
+    uint64_t end;
+    sim::Bus::Result result = sim::Bus::instance().transact(tx_address, false, tx_buffer, tx_count, end);
+    if (result == sim::Bus::Result::Stalled)
+        return 4;
+    sim::advanceTo(end);
+    return result == sim::Bus::Result::Ok ? 0 : result == sim::Bus::Result::AddressNak ? 2 : 4;
+}
+
+size_t i2c_t3::requestFrom(uint8_t address, size_t length, i2c_stop) {
+    uint64_t end;
+    rx_index = 0;
+    rx_count = 0;
+    if (length > I2C_RX_BUFFER_LENGTH)
+        length = I2C_RX_BUFFER_LENGTH;
+    sim::Bus::Result result = sim::Bus::instance().transact(address, true, rx_buffer, length, end);
+    if (result == sim::Bus::Result::Stalled)
+        return 0;
+    sim::advanceTo(end);
+    if (result == sim::Bus::Result::Ok)
+        rx_count = length;
+    return rx_count;
+}
+
+void i2c_t3::sendTransmission(i2c_stop) {
+    background.receiving = false;
+    background.result = sim::Bus::instance().transact(tx_address, false, tx_buffer, tx_count, background.end);
+}
+
+void i2c_t3::sendRequest(uint8_t address, size_t length, i2c_stop) {
+    rx_index = 0;
+    rx_count = 0;
+    if (length > I2C_RX_BUFFER_LENGTH)
+        length = I2C_RX_BUFFER_LENGTH;
+    background.receiving = true;
+    background.result = sim::Bus::instance().transact(address, true, rx_buffer, length, background.end);
+    if (background.result == sim::Bus::Result::Ok)
+        rx_count = length;
+}
+
+uint8_t i2c_t3::done() {
+    return sim::now() >= background.end;
+}
+
+i2c_status i2c_t3::status() {
+    if (!done())
+        return background.receiving ? I2C_RECEIVING : I2C_SENDING;
+    return finalStatus(background.result);
+}
+
+int i2c_t3::available() {
+    if (!done())
+        return 0;
+    return (int)(rx_count - rx_index);
+}
+
+int i2c_t3::read() {
+    if (!done() || rx_index == rx_count)
+        return -1;
+    return rx_buffer[rx_index++];
+}
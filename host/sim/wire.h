@@ -0,0 +1,96 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <wire.h/cpp>
+
+    Simulated I2C bus behind the host i2c_t3.h. Transfers take bus time, devices can be made to NAK, lose
+    arbitration or hold the bus, and every transaction is logged for the tests.
+
+*/
+
+#ifndef sim_wire_h
+#define sim_wire_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace sim {
+
+class I2CDevice {
+   public:
+    virtual ~I2CDevice() {
+    }
+    virtual uint8_t address() const = 0;
+    virtual bool present() const {  // false makes the device NAK its address, e.g. while hidden behind another chip
+        return true;
+    }
+    virtual void write(const uint8_t *data, size_t count) = 0;  // everything after the address byte
+    virtual void read(uint8_t *data, size_t count) = 0;
+};
+
+class Bus {
+   public:
+    enum class Result : uint8_t {
+        Ok,
+        AddressNak,
+        ArbitrationLost,
+        Stalled,  // never finished; only a Wire.begin() frees the bus
+    };
+
+    struct Transaction {
+        uint8_t address;
+        bool is_read;
+        uint8_t count;
+        uint64_t start;  // when the address byte went out
+        uint64_t end;    // when the bus was free again
+        Result result;
+    };
+
+    static Bus &instance();
+
+    void add(I2CDevice *device);
+    void reset();  // no devices, default timing, nothing injected, empty log
+
+    // a transaction takes overhead + (count + 1) * byte time; 9 bits at 400kHz make 22.5us per byte
+    void setTiming(uint32_t overhead_ns, uint32_t byte_ns);
+    uint64_t duration(size_t count) const;
+
+    // faults applied to the next transactions; a NAK only counts transactions to that address
+    void injectNak(uint8_t address, uint32_t count = 1);
+    void injectArbitrationLoss(uint32_t count = 1);
+    void injectStall(uint32_t count = 1);
+
+    // runs one transaction; a read fills data, and the device sees it as soon as it starts
+    Result transact(uint8_t address, bool is_read, uint8_t *data, size_t count, uint64_t &end);
+    void released();  // Wire.begin(), which is also how the flight code recovers a held bus
+
+    const std::vector<Transaction> &log() const {
+        return transactions;
+    }
+    void clearLog() {
+        transactions.clear();
+    }
+    uint32_t beginCount() const {
+        return begins;
+    }
+
+   private:
+    I2CDevice *find(uint8_t address) const;
+
+    std::vector<I2CDevice *> devices;
+    std::vector<Transaction> transactions;
+    uint32_t overhead_ns{10000};
+    uint32_t byte_ns{22500};
+    uint8_t nak_address{0};
+    uint32_t naks{0};
+    uint32_t arbitration_losses{0};
+    uint32_t stalls{0};
+    uint32_t begins{0};
+};
+
+}  // namespace sim
+
+#endif
@@ -0,0 +1,45 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <ADC.h>
+
+    The pedvide ADC library calls the flight code uses, for the host build.
+    Readings come from sim::setAnalog.
+
+*/
+
+#ifndef ADC_H
+#define ADC_H
+
+#include <stdint.h>
+
+#define ADC_0 0
+#define ADC_1 1
+
+#define ADC_REF_3V3 0
+#define ADC_REF_1V2 2
+
+#define ADC_VERY_LOW_SPEED 0
+#define ADC_LOW_SPEED 1
+#define ADC_MED_SPEED 2
+#define ADC_HIGH_SPEED 3
+#define ADC_VERY_HIGH_SPEED 4
+
+class ADC {
+   public:
+    void setReference(uint8_t, int8_t = ADC_0) {
+    }
+    void setAveraging(uint8_t, int8_t = ADC_0) {
+    }
+    void setResolution(uint8_t, int8_t = ADC_0) {
+    }
+    void setConversionSpeed(uint8_t, int8_t = ADC_0) {
+    }
+    void setSamplingSpeed(uint8_t, int8_t = ADC_0) {
+    }
+    int analogRead(uint8_t pin, int8_t adc_num = ADC_0);
+};
+
+#endif
@@ -0,0 +1,160 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <Arduino.h>
+
+    The part of the Teensyduino core the flight code uses, for the host build.
+    Time, pins and interrupts come from the simulator in host/sim.
+
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define PI 3.1415926535897932384626433832795
+#define HALF_PI 1.5707963267948966192313216916398
+#define TWO_PI 6.283185307179586476925286766559
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// the Teensy core's mixed-type min and max
+template <class A, class B>
+constexpr auto min(const A &a, const B &b) -> decltype(a < b ? a : b) {
+    return b < a ? b : a;
+}
+template <class A, class B>
+constexpr auto max(const A &a, const B &b) -> decltype(a < b ? a : b) {
+    return a < b ? b : a;
+}
+
+#define HIGH 1
+#define LOW 0
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define CHANGE 4
+#define FALLING 2
+#define RISING 3
+
+#define DEC 10
+#define HEX 16
+
+#define A10 34
+#define A11 35
+#define A13 37
+
+uint32_t micros();
+uint32_t millis();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+void digitalWriteFast(uint8_t pin, uint8_t value);
+uint8_t digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+void analogWriteFrequency(uint8_t pin, float frequency);
+void analogWriteResolution(uint32_t bits);
+
+void attachInterrupt(uint8_t pin, void (*function)(void), int mode);
+void detachInterrupt(uint8_t pin);
+void noInterrupts();
+void interrupts();
+
+class String {
+   public:
+    String() {
+    }
+    String(const char *text) : text(text ? text : "") {
+    }
+    String(char c) : text(1, c) {
+    }
+
+    size_t length() const {
+        return text.size();
+    }
+    char charAt(size_t index) const {
+        return index < text.size() ? text[index] : 0;
+    }
+    const char *c_str() const {
+        return text.c_str();
+    }
+
+    String &operator+=(char c) {
+        text += c;
+        return *this;
+    }
+    String &operator+=(const char *other) {
+        text += other;
+        return *this;
+    }
+    String &operator+=(const String &other) {
+        text += other.text;
+        return *this;
+    }
+
+   private:
+    std::string text;
+};
+
+// USB serial; whatever the flight code writes is kept for the test to inspect
+class usb_serial_class {
+   public:
+    void begin(long) {
+    }
+    int available();
+    int read();
+    size_t write(uint8_t b);
+    size_t write(const uint8_t *buffer, size_t size);
+
+    size_t print(const char *text);
+    size_t print(const String &text) {
+        return print(text.c_str());
+    }
+    size_t print(char c) {
+        return write((uint8_t)c);
+    }
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(int n, int base = DEC) {
+        return print((long)n, base);
+    }
+    size_t print(unsigned int n, int base = DEC) {
+        return print((unsigned long)n, base);
+    }
+    size_t print(unsigned char n, int base = DEC) {
+        return print((unsigned long)n, base);
+    }
+    size_t print(double n, int digits = 2);
+
+    size_t println() {
+        return print("\r\n");
+    }
+    template <typename T>
+    size_t println(T value) {
+        return print(value) + println();
+    }
+    template <typename T>
+    size_t println(T value, int format) {
+        return print(value, format) + println();
+    }
+};
+
+extern usb_serial_class Serial;
+
+#endif
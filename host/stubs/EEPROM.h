@@ -0,0 +1,40 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <EEPROM.h>
+
+    The Teensy 3.2 EEPROM, kept in memory for the host build.
+
+*/
+
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <stdint.h>
+
+class EEPROMClass {
+   public:
+    static const int SIZE = 2048;
+
+    uint8_t read(int index) const {
+        return data[index];
+    }
+    void write(int index, uint8_t value) {
+        data[index] = value;
+    }
+    uint8_t &operator[](int index) {
+        return data[index];
+    }
+    uint8_t operator[](int index) const {
+        return data[index];
+    }
+
+   private:
+    uint8_t data[SIZE]{0};
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,72 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <i2c_t3.h>
+
+    The i2c_t3 master API the flight code uses, for the host build.
+    Transfers go to the simulated bus in host/sim/wire.h instead of the I2C0 hardware.
+
+*/
+
+#ifndef I2C_T3_H
+#define I2C_T3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum i2c_mode { I2C_MASTER, I2C_SLAVE };
+enum i2c_pins { I2C_PINS_16_17, I2C_PINS_18_19 };
+enum i2c_pullup { I2C_PULLUP_EXT, I2C_PULLUP_INT };
+enum i2c_rate { I2C_RATE_100, I2C_RATE_200, I2C_RATE_300, I2C_RATE_400 };
+enum i2c_stop { I2C_NOSTOP, I2C_STOP };
+enum i2c_status {
+    I2C_WAITING,
+    I2C_SENDING,
+    I2C_SEND_ADDR,
+    I2C_RECEIVING,
+    I2C_TIMEOUT,
+    I2C_ADDR_NAK,
+    I2C_DATA_NAK,
+    I2C_ARB_LOST,
+    I2C_BUF_OVF,
+    I2C_SLAVE_TX,
+    I2C_SLAVE_RX,
+};
+
+#define I2C_TX_BUFFER_LENGTH 259
+#define I2C_RX_BUFFER_LENGTH 259
+
+class i2c_t3 {
+   public:
+    void begin(i2c_mode mode, uint8_t address, i2c_pins pins, i2c_pullup pullup, i2c_rate rate);
+
+    // blocking
+    void beginTransmission(uint8_t address);
+    size_t write(uint8_t data);
+    size_t write(const uint8_t *data, size_t count);
+    uint8_t endTransmission(i2c_stop stop = I2C_STOP);  // 0 on success, 2 on address NAK, 4 on other errors
+    size_t requestFrom(uint8_t address, size_t length, i2c_stop stop = I2C_STOP);
+
+    // background; done() turns true once the transfer left the bus, status() then tells how it went
+    void sendTransmission(i2c_stop stop = I2C_STOP);
+    void sendRequest(uint8_t address, size_t length, i2c_stop stop = I2C_STOP);
+    uint8_t done();
+    i2c_status status();
+
+    int available();
+    int read();
+
+   private:
+    uint8_t tx_address{0};
+    uint8_t tx_buffer[I2C_TX_BUFFER_LENGTH];
+    size_t tx_count{0};
+    uint8_t rx_buffer[I2C_RX_BUFFER_LENGTH];
+    size_t rx_count{0};
+    size_t rx_index{0};
+};
+
+extern i2c_t3 Wire;
+
+#endif
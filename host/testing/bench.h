@@ -0,0 +1,71 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <bench.h>
+
+    Timing helpers for the host benchmarks. Numbers are host nanoseconds and, on x86, TSC cycles per call:
+    they compare two versions of the same code, they are not Cortex-M4 cycle counts.
+
+*/
+
+#ifndef testing_bench_h
+#define testing_bench_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace bench {
+
+struct Result {
+    double nanoseconds;  // per call
+    double cycles;       // per call, 0 where there is no cycle counter
+};
+
+inline uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// keeps the compiler from optimizing away a result nobody reads
+template <typename T>
+inline void keep(T &&value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// best of repeats runs of iterations calls, which filters out most scheduling noise
+template <typename F>
+Result measure(uint32_t iterations, F &&function, uint8_t repeats = 7) {
+    Result best{1e30, 1e30};
+    for (uint8_t r = 0; r < repeats; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t start_cycles = cycles();
+        for (uint32_t i = 0; i < iterations; ++i)
+            function(i);
+        uint64_t end_cycles = cycles();
+        auto end = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+        double cy = (double)(end_cycles - start_cycles) / iterations;
+        if (ns < best.nanoseconds) {
+            best.nanoseconds = ns;
+            best.cycles = cy;
+        }
+    }
+    return best;
+}
+
+inline void report(const char *name, const Result &result, const char *unit = "call") {
+    printf("%-48s %10.1f ns/%s %10.1f cycles/%s\n", name, result.nanoseconds, unit, result.cycles, unit);
+}
+
+}  // namespace bench
+
+#endif
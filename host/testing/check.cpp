@@ -0,0 +1,61 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include "check.h"
+
+#include <string.h>
+#include <vector>
+#include "sim.h"
+#include "wire.h"
+
+namespace testing {
+namespace {
+struct Test {
+    const char *name;
+    TestFunction function;
+};
+
+std::vector<Test> &tests() {
+    static std::vector<Test> registered;
+    return registered;
+}
+
+const char *current{nullptr};
+unsigned failures{0};
+}  // namespace
+
+Registration::Registration(const char *name, TestFunction function) {
+    tests().push_back({name, function});
+}
+
+void fail(const char *file, int line, const char *expression, const char *detail) {
+    ++failures;
+    printf("%s:%d: %s: CHECK(%s) failed%s%s\n", file, line, current, expression, detail ? ": " : "", detail ? detail : "");
+}
+
+}  // namespace testing
+
+// runs every test, or the ones whose name contains the first argument
+int main(int argc, char **argv) {
+    unsigned failed_tests = 0;
+    unsigned run = 0;
+    for (const testing::Test &test : testing::tests()) {
+        if (argc > 1 && !strstr(test.name, argv[1]))
+            continue;
+        sim::reset();
+        sim::Bus::instance().reset();
+        testing::current = test.name;
+        unsigned before = testing::failures;
+        test.function();
+        ++run;
+        bool passed = testing::failures == before;
+        if (!passed)
+            ++failed_tests;
+        printf("[%s] %s\n", passed ? "  OK  " : " FAIL ", test.name);
+    }
+    printf("%u of %u tests passed\n", run - failed_tests, run);
+    return failed_tests ? 1 : 0;
+}
@@ -0,0 +1,68 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <check.h/cpp>
+
+    Minimal test runner for the host tests, so they need nothing beyond a C++ compiler.
+
+    TEST(name) { CHECK(...); } registers a test; every test starts with a fresh simulator and bus.
+    A failed check reports and continues; the executable exits non-zero if any check failed.
+
+*/
+
+#ifndef testing_check_h
+#define testing_check_h
+
+#include <math.h>
+#include <stdio.h>
+
+namespace testing {
+
+using TestFunction = void (*)();
+
+struct Registration {
+    Registration(const char *name, TestFunction function);
+};
+
+void fail(const char *file, int line, const char *expression, const char *detail = nullptr);
+
+}  // namespace testing
+
+#define TEST(name)                                                        \
+    static void test_##name();                                            \
+    static testing::Registration registration_##name(#name, test_##name); \
+    static void test_##name()
+
+#define CHECK(condition)                                      \
+    do {                                                      \
+        if (!(condition))                                     \
+            testing::fail(__FILE__, __LINE__, #condition);    \
+    } while (false)
+
+#define CHECK_EQ(actual, expected)                                                                              \
+    do {                                                                                                        \
+        auto check_actual_ = (actual);                                                                          \
+        auto check_expected_ = (expected);                                                                      \
+        if (!(check_actual_ == check_expected_)) {                                                              \
+            char check_detail_[96];                                                                             \
+            snprintf(check_detail_, sizeof(check_detail_), "got %lld, expected %lld", (long long)check_actual_, \
+                     (long long)check_expected_);                                                               \
+            testing::fail(__FILE__, __LINE__, #actual " == " #expected, check_detail_);                         \
+        }                                                                                                       \
+    } while (false)
+
+#define CHECK_NEAR(actual, expected, tolerance)                                                                   \
+    do {                                                                                                          \
+        double check_actual_ = (actual);                                                                          \
+        double check_expected_ = (expected);                                                                      \
+        if (!(fabs(check_actual_ - check_expected_) <= (tolerance))) {                                            \
+            char check_detail_[96];                                                                               \
+            snprintf(check_detail_, sizeof(check_detail_), "got %.9g, expected %.9g +/- %.3g", check_actual_,     \
+                     check_expected_, (double)(tolerance));                                                       \
+            testing::fail(__FILE__, __LINE__, #actual " ~ " #expected, check_detail_);                            \
+        }                                                                                                         \
+    } while (false)
+
+#endif
@@ -0,0 +1,56 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <kalmanReference.h>
+
+    The altitude Kalman filter as it was before Matrix and SymmetricMatrix, for kalmanTest to check the current
+    one against and kalmanBench to time it against.
+
+*/
+
+#ifndef testing_kalmanReference_h
+#define testing_kalmanReference_h
+
+#include "lapack.h"
+
+const int P_Z = 0, A_Z = 2;         // localization.cpp: SE_STATE_P_Z and SE_STATE_A_Z
+const float ACC_VARIANCE = 0.01f;   // SE_ACC_VARIANCE
+const float BARO_VARIANCE = 1e-3f;  // STATE_BARO_VARIANCE
+
+// full 3x3 column major covariance and the BLAS style calls
+inline void referencePredict(float deltaTime, float *state, float *covar) {
+    float F[9] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+    static const float Q[9] = {0.06f, 0.0f, 0.0f, 0.0f, 0.04f, 0.0f, 0.0f, 0.0f, 0.01f};
+    static const int n = 3;
+    static const float f_one = 1.0f, f_zero = 0.0f;
+    float buffer[9];
+
+    if (!(deltaTime > 0.0f))
+        return;
+    F[3] = deltaTime;
+    F[6] = deltaTime * deltaTime * 0.5f;
+    state[0] += F[3] * state[1] + F[6] * state[2];
+    F[7] = deltaTime;
+    state[1] += F[7] * state[2];
+    Fgemm_("n", "t", &n, &n, &n, &f_one, covar, &n, F, &n, &f_zero, buffer, &n);
+    Flacpy_(" ", &n, &n, Q, &n, covar, &n);
+    Fgemm_("n", "n", &n, &n, &n, &f_one, F, &n, buffer, &n, &deltaTime, covar, &n);
+}
+
+inline void referenceCorrect(float *state, float *covar, int coordinate, float value, float variance) {
+    static const int n = 3, i_one = 1;
+    static const float f_one = 1.0f, f_minus_one = -1.0f;
+    float y = value - state[coordinate];
+    float k_opt[3], h_row[3];
+    float s_inverse = 1.0f / (covar[coordinate * 4] + variance);
+    for (int i = 0; i < 3; ++i) {
+        k_opt[i] = covar[i + coordinate * 3] * s_inverse;
+        state[i] += k_opt[i] * y;
+        h_row[i] = covar[coordinate + 3 * i];
+    }
+    Fgemm_("n", "n", &n, &n, &i_one, &f_minus_one, k_opt, &n, h_row, &i_one, &f_one, covar, &n);
+}
+
+#endif
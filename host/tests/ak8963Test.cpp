@@ -0,0 +1,100 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include "check.h"
+#include "rig.h"
+
+TEST(who_am_i) {
+    SensorRig rig;
+    rig.mpu.restart();  // opens the bypass to the auxiliary bus
+    CHECK_EQ(rig.mag.getID(), 0x48);
+}
+
+TEST(hidden_behind_mpu_master) {
+    SensorRig rig;
+    rig.start(true);
+    CHECK(!rig.mpu_model.bypassOpen());
+    CHECK_EQ(rig.mag.getID(), 0);  // NAKs its address
+}
+
+TEST(continuous_mode_at_100hz) {
+    SensorRig rig;
+    rig.start(false);
+    CHECK_EQ(rig.mag_model.peek(sim::AK8963Model::CNTL1), 0x16);
+    uint32_t measurements = rig.mag_model.measurementCount();
+    rig.run(1000000);
+    measurements = rig.mag_model.measurementCount() - measurements;
+    CHECK(measurements >= 99 && measurements <= 101);
+    CHECK_EQ(rig.mag.skippedCount(), 0u);
+    // reads aim a millisecond ahead of each sample and retry until it is there
+    CHECK(rig.mag.staleCount() <= 2 * measurements);
+}
+
+TEST(sensitivity_adjustment_is_applied) {
+    SensorRig rig;
+    rig.mag_model.setAdjustment(176, 128, 64);  // 1.1875, 1 and 0.75
+    rig.mag_model.setField(1000, 1000, 1000);
+    rig.start(false);
+    rig.run(50000);
+    const float mRes = 10.0f * 4912.0f / 32760.0f;
+    // MAG_XDIR 1 and MAG_YDIR 0: the adjustment is taken in flyer axis order
+    CHECK_NEAR(rig.state.mag[0] + CONFIG.data.magBias[0], 1000 * mRes, 1e-3);
+    CHECK_NEAR(rig.state.mag[1] + CONFIG.data.magBias[1], 1187 * mRes, 1e-3);
+    CHECK_NEAR(rig.state.mag[2] + CONFIG.data.magBias[2], -750 * mRes, 1e-3);
+}
+
+TEST(late_reads_count_skipped_samples) {
+    SensorRig rig;
+    rig.start(false);
+    rig.run(50000);
+    uint32_t skipped = rig.mag.skippedCount();
+    sim::advance(35000);  // the loop stalls for three and a half sample periods
+    rig.run(20000);
+    CHECK_EQ(rig.mag.skippedCount(), skipped + 1);
+}
+
+TEST(reads_through_mpu_are_not_stale) {
+    SensorRig rig;
+    rig.start(true);
+    uint32_t measurements = rig.mag_model.measurementCount();
+    rig.run(1000000);
+    measurements = rig.mag_model.measurementCount() - measurements;
+    CHECK(measurements >= 99 && measurements <= 101);
+    // ~900 copies a second without a new sample are how the MPU9250 master works, not late reads
+    CHECK_EQ(rig.mag.staleCount(), 0u);
+    CHECK_EQ(rig.mag.skippedCount(), 0u);
+}
+
+TEST(set_mode_direct) {
+    SensorRig rig;
+    rig.start(false);
+    CHECK(rig.mag.setMode(0x12));  // 16 bit, continuous mode 1 (8Hz)
+    rig.run(50000);
+    CHECK_EQ(rig.mag_model.peek(sim::AK8963Model::CNTL1), 0x12);
+    uint32_t measurements = rig.mag_model.measurementCount();
+    rig.run(1000000);
+    measurements = rig.mag_model.measurementCount() - measurements;
+    CHECK(measurements >= 7 && measurements <= 9);
+}
+
+TEST(set_mode_through_mpu) {
+    SensorRig rig;
+    rig.start(true);
+    uint32_t writes = rig.mpu_model.auxiliaryWrites();
+    CHECK(rig.mag.setMode(0x12));
+    CHECK(!rig.mag.setMode(0x16));  // still in flight
+    rig.run(50000);
+    CHECK_EQ(rig.mpu_model.auxiliaryWrites(), writes + 1);  // slave 4 sent it once
+    CHECK_EQ(rig.mag_model.peek(sim::AK8963Model::CNTL1), 0x12);
+    uint32_t measurements = rig.mag_model.measurementCount();
+    rig.run(1000000);
+    measurements = rig.mag_model.measurementCount() - measurements;
+    CHECK(measurements >= 7 && measurements <= 9);
+    // and back, once the first write is done
+    CHECK(rig.mag.setMode(0x16));
+    rig.run(50000);
+    CHECK_EQ(rig.mag_model.peek(sim::AK8963Model::CNTL1), 0x16);
+}
@@ -0,0 +1,57 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include <math.h>
+#include "biquad.h"
+#include "check.h"
+
+namespace {
+
+// steady state amplitude of the response to a sine at frequency_hz
+float gain(Biquad filter, float frequency_hz, float sample_hz) {
+    float peak = 0.0f;
+    for (uint32_t i = 0; i < 20000; ++i) {
+        float y = filter.apply(sinf(2.0f * (float)M_PI * frequency_hz * (float)i / sample_hz));
+        if (i > 10000 && fabsf(y) > peak)
+            peak = fabsf(y);
+    }
+    return peak;
+}
+
+}  // namespace
+
+TEST(default_passes_through) {
+    Biquad filter;
+    CHECK_EQ(filter.apply(1.25f), 1.25f);
+    CHECK_EQ(filter.apply(-3.0f), -3.0f);
+    CHECK_NEAR(filter.groupDelay(), 0.0, 1e-6);
+}
+
+TEST(butterworth_response) {
+    Biquad filter(80.0f, 1000.0f);
+    CHECK_NEAR(gain(filter, 1.0f, 1000.0f), 1.0, 1e-3);
+    CHECK_NEAR(gain(filter, 80.0f, 1000.0f), M_SQRT1_2, 5e-3);  // -3dB at the cutoff
+    CHECK(gain(filter, 400.0f, 1000.0f) < 0.05f);  // what decimation by 4 would fold down to 100Hz
+}
+
+TEST(reset_settles_at_input) {
+    Biquad filter(20.0f, 1000.0f);
+    filter.reset(0.75f);
+    for (uint8_t i = 0; i < 10; ++i)
+        CHECK_NEAR(filter.apply(0.75f), 0.75, 1e-5);  // the rounded coefficients miss unity DC gain by a few ulp
+}
+
+TEST(group_delay_matches_step_response) {
+    // the centroid of the impulse response is the delay at DC
+    Biquad filter(40.0f, 1000.0f);
+    double weighted = 0.0, total = 0.0;
+    for (uint32_t i = 0; i < 2000; ++i) {
+        float h = filter.apply(i == 0 ? 1.0f : 0.0f);
+        weighted += (double)i * h;
+        total += h;
+    }
+    CHECK_NEAR(filter.groupDelay(), weighted / total, 1e-2);
+}
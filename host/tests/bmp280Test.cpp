@@ -0,0 +1,206 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include "check.h"
+#include "rig.h"
+
+// datasheet section 8.2 example calibration and readings: 25.08 DegC, and 100653.27 Pa in the table, although
+// its own formulas give 100653.25 Pa in 64 bit integers and 100653.26 Pa in double precision
+TEST(chip_id) {
+    SensorRig rig;
+    CHECK_EQ(rig.bmp.getID(), 0x58);
+}
+
+TEST(example_compensation_int64) {
+    SensorRig rig;
+    rig.start(false);
+    CHECK_EQ(rig.state.temperature, 2508);
+    CHECK_EQ(rig.state.pressure, 25767233u);
+}
+
+TEST(example_compensation_int32) {
+    SensorRig rig;
+    rig.bmp.setCompensation(BMP280::Compensation::Int32);
+    rig.start(false);
+    CHECK_EQ(rig.state.pressure, 100656u << 8);
+}
+
+TEST(example_compensation_float) {
+    SensorRig rig;
+    rig.bmp.setCompensation(BMP280::Compensation::Float);
+    rig.start(false);
+    CHECK_NEAR(rig.state.pressure / 256.0, 100653.258, 0.05);
+}
+
+namespace {
+// compensates one raw reading through the driver; the readings have to differ from the previous ones
+uint32_t compensate(SensorRig &rig, int32_t raw_p, int32_t raw_t) {
+    rig.bmp_model.setRaw(raw_p, raw_t);
+    rig.run(100000);
+    return rig.state.pressure;
+}
+}  // namespace
+
+// -20 to 60 DegC and 30 to 116 kPa with the example calibration, against the datasheet's double precision formula
+TEST(compensation_accuracy) {
+    const int32_t raw_t[] = {380000, 450000, 519888, 580000, 630000};
+    const int32_t raw_p[] = {360000, 415148, 480000, 560000, 640000, 720000, 820000};
+    const BMP280::Compensation modes[] = {BMP280::Compensation::Int32, BMP280::Compensation::Int64, BMP280::Compensation::Float};
+    // Pa; the 32 bit formula truncates its intermediate terms and is off by up to ~4 Pa, some 30cm of altitude
+    const double limits[] = {4.0, 0.05, 0.05};
+    SensorRig rig;
+    rig.start(false);
+    for (uint8_t m = 0; m < 3; ++m) {
+        rig.bmp.setCompensation(modes[m]);
+        double worst = 0;
+        for (int32_t t : raw_t) {
+            for (int32_t p : raw_p) {
+                double pressure = compensate(rig, p, t) / 256.0;
+                double error = fabs(pressure - rig.bmp_model.referencePressure());
+                if (error > worst)
+                    worst = error;
+            }
+        }
+        CHECK(worst < limits[m]);
+    }
+}
+
+TEST(reads_follow_conversions) {
+    SensorRig rig;
+    rig.bmp_model.setPressureStep(1);  // real readings never repeat exactly
+    rig.start(false);
+    rig.run(200000);  // past the first read, whose window spans the MPU9250 setup
+    uint32_t conversions = rig.bmp_model.conversionCount();
+    uint32_t duplicates = rig.bmp.duplicateCount();
+    uint32_t fresh = 0;
+    uint32_t worst_offset = 0;
+    uint64_t until = sim::now() + 1000000;
+    while (sim::now() < until) {
+        rig.i2c.update();
+        if (rig.bmp.ready) {
+            if (rig.bmp.newSample()) {
+                ++fresh;
+                uint32_t offset = (uint32_t)(rig.bmp_model.lastConversion() - rig.bmp.sampleMicros());
+                if ((int32_t)offset < 0)
+                    offset = -offset;
+                if (offset > worst_offset)
+                    worst_offset = offset;
+            }
+            rig.bmp.startMeasurement();
+        }
+        sim::advance(50);
+    }
+    conversions = rig.bmp_model.conversionCount() - conversions;
+    duplicates = rig.bmp.duplicateCount() - duplicates;
+    CHECK(fresh + 1 >= conversions);
+    CHECK(fresh <= conversions + 1);
+    // reads aim just ahead of each conversion and retry once or twice
+    CHECK(duplicates <= 3 * conversions);
+    CHECK(worst_offset <= 2 * BMP280_RETRY_PERIOD);
+}
+
+TEST(control_settings_follow_confirmed_writes) {
+    SensorRig rig;
+    rig.bmp_model.setPressureStep(1);
+    rig.start(false);
+    uint8_t ctrl_meas = OSRS_T_X1 | OSRS_P_X1 | MODE_NORMAL;
+    uint8_t config = FILTER_OFF | T_SB_62p5ms;
+    CHECK(rig.bmp.setControl(ctrl_meas, config));
+    CHECK(!rig.bmp.setControl(ctrl_meas, config));  // still in flight
+    rig.run(100000);
+    CHECK_EQ(rig.bmp_model.peek(sim::BMP280Model::CTRL_MEAS), ctrl_meas);
+    CHECK_EQ(rig.bmp_model.peek(sim::BMP280Model::CONFIG), config);
+    CHECK_EQ(rig.bmp.configFailureCount(), 0u);
+    // ~68ms per conversion now, and the reads slowed down with it
+    uint32_t conversions = rig.bmp_model.conversionCount();
+    uint32_t duplicates = rig.bmp.duplicateCount();
+    rig.run(1000000);
+    conversions = rig.bmp_model.conversionCount() - conversions;
+    duplicates = rig.bmp.duplicateCount() - duplicates;
+    CHECK(conversions >= 13 && conversions <= 16);
+    CHECK(duplicates <= 3 * conversions);
+}
+
+TEST(control_writes_are_queued_together_or_not_at_all) {
+    SensorRig rig;
+    rig.start(false);
+    // nothing polls the bus, so the low priority queue stays one slot short of both writes
+    uint8_t reg[1]{BMP280_FACTORY_CALIBRATION};
+    uint8_t data[1];
+    while (rig.i2c.transferQueue(I2CPriority::Low).space() > 1)
+        rig.i2c.addTransfer(BMP280_ADDR, 1, reg, 1, data, &rig.bmp, I2CPriority::Low);
+    uint8_t queued = rig.i2c.transferQueue(I2CPriority::Low).size();
+    CHECK(!rig.bmp.setControl(OSRS_T_X1 | OSRS_P_X1 | MODE_NORMAL, FILTER_OFF | T_SB_62p5ms));
+    CHECK_EQ(rig.i2c.transferQueue(I2CPriority::Low).size(), queued);
+}
+
+TEST(ignored_config_write_is_reported) {
+    SensorRig rig;
+    rig.bmp_model.setPressureStep(1);
+    rig.bmp_model.setIgnoreConfigInNormalMode(true);
+    rig.start(false);
+    uint8_t config = FILTER_X16 | T_SB_62p5ms;
+    CHECK(rig.bmp.setControl(rig.bmp_model.peek(sim::BMP280Model::CTRL_MEAS), config));
+    rig.run(100000);
+    CHECK(rig.bmp_model.peek(sim::BMP280Model::CONFIG) != config);
+    CHECK_EQ(rig.bmp.configFailureCount(), 1u);
+    // the read schedule still follows the 0.5ms standby the sensor kept
+    uint32_t conversions = rig.bmp_model.conversionCount();
+    rig.run(1000000);
+    CHECK(rig.bmp_model.conversionCount() - conversions > 20);
+}
+
+namespace {
+class Sink : public CallbackProcessor {
+   public:
+    void processCallback(uint8_t count, uint8_t *data) {
+    }
+};
+}  // namespace
+
+TEST(timestamps_follow_bus_time_not_queue_time) {
+    // every barometer read waits ~4.5ms behind a long high priority transfer, as it would behind an IMU FIFO batch
+    SensorRig rig;
+    rig.bmp_model.setPressureStep(1);
+    rig.start(false);
+    rig.run(200000);
+    Sink sink;
+    uint8_t calibration_register[1]{BMP280_FACTORY_CALIBRATION};
+    uint8_t hog[200];
+    uint32_t fresh = 0;
+    uint32_t worst_deviation = 0;
+    uint32_t outside = 0;
+    uint64_t until = sim::now() + 1000000;
+    while (sim::now() < until) {
+        rig.i2c.update();
+        if (rig.bmp.ready) {
+            if (rig.bmp.newSample()) {
+                // the conversion ended between the last two result reads, and is stamped halfway between them
+                const sim::Bus::Transaction *reads[2]{nullptr, nullptr};
+                const std::vector<sim::Bus::Transaction> &log = sim::Bus::instance().log();
+                for (auto t = log.rbegin(); t != log.rend() && !reads[1]; ++t)
+                    if (t->address == BMP280_ADDR && t->is_read && t->count == 6)
+                        reads[reads[0] ? 1 : 0] = &*t;
+                if (fresh++ && reads[1]) {
+                    uint64_t conversion = rig.bmp_model.lastConversion();
+                    if (conversion < reads[1]->start || conversion > reads[0]->end)
+                        ++outside;
+                    uint32_t expected = (uint32_t)((reads[1]->start + reads[1]->end + reads[0]->start + reads[0]->end) / 4);
+                    int32_t deviation = (int32_t)(rig.bmp.sampleMicros() - expected);
+                    if ((uint32_t)abs(deviation) > worst_deviation)
+                        worst_deviation = abs(deviation);
+                }
+            }
+            if (rig.bmp.startMeasurement())  // both are queued before the next update, so the hog goes first
+                rig.i2c.addTransfer(BMP280_ADDR, 1, calibration_register, 200, hog, &sink, I2CPriority::High);
+        }
+        sim::advance(50);
+    }
+    CHECK(fresh >= 20);
+    CHECK_EQ(outside, 0u);
+    // within the register address write and the polling step, not the ~4.5ms spent waiting in the queue
+    CHECK(worst_deviation < 300);
+}
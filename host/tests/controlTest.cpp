@@ -0,0 +1,136 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include <math.h>
+#include "check.h"
+#include "control.h"
+
+namespace {
+
+void multiply(const double a[4], const double b[4], double out[4]) {
+    out[0] = a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3];
+    out[1] = a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2];
+    out[2] = a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1];
+    out[3] = a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0];
+}
+
+// a turn by angle_deg about body axis 0, 1 or 2
+void axisTurn(uint8_t axis, double angle_deg, double out[4]) {
+    double half = angle_deg * M_PI / 360.0;
+    out[0] = cos(half);
+    out[1] = out[2] = out[3] = 0.0;
+    out[axis + 1] = sin(half);
+}
+
+// level (a half turn about x), then yaw, roll and pitch
+void attitude(double pitch_deg, double roll_deg, double yaw_deg, float q[4]) {
+    const double level[4]{0.0, 1.0, 0.0, 0.0};
+    double yaw[4], roll[4], pitch[4], a[4], b[4], c[4];
+    axisTurn(2, yaw_deg, yaw);
+    axisTurn(1, roll_deg, roll);
+    axisTurn(0, pitch_deg, pitch);
+    multiply(level, yaw, a);
+    multiply(a, roll, b);
+    multiply(b, pitch, c);
+    for (uint8_t i = 0; i < 4; ++i)
+        q[i] = (float)c[i];
+}
+
+// State::kinematicsAngle, in degrees
+void eulerAngles(const float q[4], double angle[3]) {
+    double r11 = 2.0 * (q[2] * q[3] + q[1] * q[0]);
+    double r12 = q[1] * q[1] + q[2] * q[2] - q[3] * q[3] - q[0] * q[0];
+    double r21 = -2.0 * (q[2] * q[0] - q[1] * q[3]);
+    double r31 = 2.0 * (q[3] * q[0] + q[1] * q[2]);
+    double r32 = q[1] * q[1] - q[2] * q[2] - q[3] * q[3] + q[0] * q[0];
+    angle[0] = -atan2(r11, r12) * 180.0 / M_PI;
+    angle[1] = asin(r21) * 180.0 / M_PI;
+    angle[2] = -atan2(r31, r32) * 180.0 / M_PI;
+}
+
+// q turned by angle_deg about its own body axis
+void bodyTurn(const float q[4], uint8_t axis, double angle_deg, float out[4]) {
+    double a[4]{q[0], q[1], q[2], q[3]}, turn[4], b[4];
+    axisTurn(axis, angle_deg, turn);
+    multiply(a, turn, b);
+    for (uint8_t i = 0; i < 4; ++i)
+        out[i] = (float)b[i];
+}
+
+const double attitudes[][3] = {{0, 0, 0},    {20, 20, 0},     {30, 30, 0},  {20, 20, 90},   {30, -30, -150}, {-25, 40, 179},
+                               {45, 0, 60}, {0, -45, -60}, {-35, 15, 120}, {10, -50, 30}, {60, 20, -90}};
+
+}  // namespace
+
+TEST(attitude_construction_matches_kinematics_angle) {
+    for (const auto &a : attitudes) {
+        float q[4];
+        attitude(a[0], a[1], a[2], q);
+        double angle[3];
+        eulerAngles(q, angle);
+        for (uint8_t i = 0; i < 3; ++i)
+            CHECK_NEAR(angle[i], a[i], 1e-3);
+    }
+}
+
+TEST(no_error_at_the_commanded_attitude) {
+    for (const auto &a : attitudes) {
+        float q[4];
+        attitude(a[0], a[1], a[2], q);
+        float error[3];
+        attitudeError(q, (float)a[0], (float)a[1], (float)a[2], false, error);
+        for (uint8_t i = 0; i < 3; ++i)
+            CHECK_NEAR(error[i], 0.0, 0.05);
+        // holding the heading: whatever yaw is commanded, the current one is kept
+        attitudeError(q, (float)a[0], (float)a[1], 77.0f, true, error);
+        for (uint8_t i = 0; i < 3; ++i)
+            CHECK_NEAR(error[i], 0.0, 0.05);
+    }
+}
+
+TEST(small_body_turns_map_to_their_own_axis) {
+    // the error is the turn back onto the command, so it has the opposite sign of the turn, as in the Euler mode
+    const double turn = 2.0;
+    for (const auto &a : attitudes) {
+        float q[4];
+        attitude(a[0], a[1], a[2], q);
+        for (uint8_t axis = 0; axis < 3; ++axis) {
+            float turned[4];
+            bodyTurn(q, axis, turn, turned);
+            float error[3];
+            attitudeError(turned, (float)a[0], (float)a[1], (float)a[2], false, error);
+            for (uint8_t i = 0; i < 3; ++i)
+                CHECK_NEAR(error[i], i == axis ? -turn : 0.0, 0.05);
+        }
+    }
+}
+
+TEST(small_euler_turns_with_held_heading) {
+    const double turn = 2.0;
+    for (const auto &a : attitudes) {
+        // pitch is the innermost Euler angle, so a pitch change is a turn about body x at any attitude
+        float q[4];
+        attitude(a[0] + turn, a[1], a[2], q);
+        float error[3];
+        attitudeError(q, (float)a[0], (float)a[1], 0.0f, true, error);
+        CHECK_NEAR(error[0], -turn, 0.05);
+        CHECK_NEAR(error[1], 0.0, 0.05);
+        CHECK_NEAR(error[2], 0.0, 0.05);
+        // a yaw change is followed, not corrected
+        attitude(a[0], a[1], a[2] + turn, q);
+        attitudeError(q, (float)a[0], (float)a[1], 0.0f, true, error);
+        for (uint8_t i = 0; i < 3; ++i)
+            CHECK_NEAR(error[i], 0.0, 0.05);
+    }
+    // level, roll is a turn about body y
+    float q[4];
+    attitude(0.0, turn, 40.0, q);
+    float error[3];
+    attitudeError(q, 0.0f, 0.0f, 0.0f, true, error);
+    CHECK_NEAR(error[0], 0.0, 0.05);
+    CHECK_NEAR(error[1], -turn, 0.05);
+    CHECK_NEAR(error[2], 0.0, 0.05);
+}
@@ -0,0 +1,282 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include <vector>
+#include "check.h"
+#include "i2cManager.h"
+#include "registerDevice.h"
+#include "rig.h"
+
+namespace {
+
+// plain register file; can drop writes to one register, like the BMP280 CONFIG register in normal mode
+class ScratchDevice : public sim::RegisterDevice {
+   public:
+    static const uint8_t ADDRESS = 0x42;
+
+    ScratchDevice() : sim::RegisterDevice(ADDRESS) {
+        for (int i = 0; i < 256; ++i)
+            registers[i] = (uint8_t)i;
+    }
+
+    void dropWrites(uint8_t reg, uint32_t count) {
+        dropped_register = reg;
+        drops = count;
+    }
+
+   protected:
+    void writeRegister(uint8_t reg, uint8_t value) override {
+        if (drops && reg == dropped_register) {
+            --drops;
+            return;
+        }
+        registers[reg] = value;
+    }
+
+   private:
+    uint8_t dropped_register{0};
+    uint32_t drops{0};
+};
+
+class Recorder : public CallbackProcessor, public RegisterWriteListener {
+   public:
+    explicit Recorder(int __id = 0) : id(__id) {
+    }
+
+    void processCallback(uint8_t count, uint8_t *data) {
+        order().push_back(id);
+        ++callbacks;
+        last_count = count;
+        if (count)
+            first_byte = data[0];
+    }
+    void processFailure() {
+        ++failures;
+    }
+    void registerWritten(const I2CRegisterWrite &write, bool success) {
+        ++(success ? written : rejected);
+        last_value = write.value();
+    }
+
+    static std::vector<int> &order() {
+        static std::vector<int> callback_order;
+        return callback_order;
+    }
+
+    int id;
+    uint32_t callbacks{0};
+    uint32_t failures{0};
+    uint32_t written{0};
+    uint32_t rejected{0};
+    uint8_t last_count{0};
+    uint8_t first_byte{0};
+    uint8_t last_value{0};
+};
+
+struct BusRig {
+    ScratchDevice device;
+    I2CManager i2c;
+    uint8_t reg[1]{0x10};
+    uint8_t data[200];
+
+    BusRig() {
+        sim::Bus::instance().add(&device);
+        i2c.begin();
+        Recorder::order().clear();
+    }
+
+    const I2CDeviceHealth &health() const {
+        for (uint8_t i = 0; i < i2c.deviceCount(); ++i)
+            if (i2c.deviceHealth(i).address == ScratchDevice::ADDRESS)
+                return i2c.deviceHealth(i);
+        static I2CDeviceHealth none{0, 0, 0, 0};
+        return none;
+    }
+};
+
+}  // namespace
+
+TEST(read_returns_register_contents) {
+    BusRig rig;
+    Recorder recorder;
+    CHECK(rig.i2c.addTransfer(ScratchDevice::ADDRESS, 1, rig.reg, 4, rig.data, &recorder));
+    CHECK(pump(rig.i2c, [&] { return recorder.callbacks > 0; }));
+    CHECK_EQ(recorder.last_count, 4);
+    for (uint8_t i = 0; i < 4; ++i)
+        CHECK_EQ(rig.data[i], 0x10 + i);
+    // register address write, then the read after a repeated start
+    CHECK_EQ(sim::Bus::instance().log().size(), 2u);
+}
+
+TEST(highest_priority_transfer_starts_first) {
+    BusRig rig;
+    Recorder low(2), medium(1), high(0);
+    rig.i2c.addTransfer(ScratchDevice::ADDRESS, 1, rig.reg, 1, rig.data, &low, I2CPriority::Low);
+    rig.i2c.addTransfer(ScratchDevice::ADDRESS, 1, rig.reg, 1, rig.data + 1, &medium, I2CPriority::Medium);
+    rig.i2c.addTransfer(ScratchDevice::ADDRESS, 1, rig.reg, 1, rig.data + 2, &high, I2CPriority::High);
+    CHECK(pump(rig.i2c, [&] { return low.callbacks > 0; }));
+    CHECK(Recorder::order() == std::vector<int>({0, 1, 2}));
+    // the medium and low transfers were waiting when high started, and low again when medium started
+    CHECK_EQ(rig.i2c.preemptionCount(), 3u);
+}
+
+TEST(full_queue_drops_transfer) {
+    BusRig rig;
+    Recorder recorder;
+    for (uint8_t i = 0; i < I2CTransferQueue::CAPACITY; ++i)
+        CHECK(rig.i2c.addTransfer(ScratchDevice::ADDRESS, 1, rig.reg, 1, rig.data, &recorder));
+    CHECK(!rig.i2c.addTransfer(ScratchDevice::ADDRESS, 1, rig.reg, 1, rig.data, &recorder));
+    CHECK_EQ(rig.i2c.transferQueue(I2CPriority::Low).overflowCount(), 1u);
+    CHECK_EQ(rig.i2c.transferQueue(I2CPriority::Low).highWater(), I2CTransferQueue::CAPACITY);
+    CHECK(pump(rig.i2c, [&] { return recorder.callbacks == I2CTransferQueue::CAPACITY; }));
+    CHECK(rig.i2c.transferQueue(I2CPriority::Low).empty());
+}
+
+TEST(nak_is_retried) {
+    BusRig rig;
+    Recorder recorder;
+    sim::Bus::instance().injectNak(ScratchDevice::ADDRESS, I2CManager::MAX_ATTEMPTS - 1);
+    rig.i2c.addTransfer(ScratchDevice::ADDRESS, 1, rig.reg, 2, rig.data, &recorder);
+    CHECK(pump(rig.i2c, [&] { return recorder.callbacks > 0; }));
+    CHECK_EQ(recorder.failures, 0u);
+    CHECK_EQ(rig.data[0], 0x10);
+    CHECK_EQ(rig.health().errors, I2CManager::MAX_ATTEMPTS - 1);
+    CHECK_EQ(rig.health().failures, 0u);
+}
+
+TEST(nak_fails_transfer_after_max_attempts) {
+    BusRig rig;
+    Recorder dead, next;
+    sim::Bus::instance().injectNak(ScratchDevice::ADDRESS, I2CManager::MAX_ATTEMPTS);
+    rig.i2c.addTransfer(ScratchDevice::ADDRESS, 1, rig.reg, 2, rig.data, &dead);
+    rig.i2c.addTransfer(ScratchDevice::ADDRESS, 1, rig.reg, 2, rig.data + 2, &next);
+    CHECK(pump(rig.i2c, [&] { return next.callbacks > 0; }));
+    CHECK_EQ(dead.failures, 1u);
+    CHECK_EQ(dead.callbacks, 0u);
+    CHECK_EQ(rig.health().errors, I2CManager::MAX_ATTEMPTS);
+    CHECK_EQ(rig.health().failures, 1u);
+    CHECK_EQ(rig.i2c.recoveryCount(), 0u);
+}
+
+TEST(stalled_bus_times_out_and_recovers) {
+    BusRig rig;
+    Recorder recorder;
+    uint32_t begins = sim::Bus::instance().beginCount();
+    sim::Bus::instance().injectStall();
+    rig.i2c.addTransfer(ScratchDevice::ADDRESS, 1, rig.reg, 2, rig.data, &recorder);
+    CHECK(pump(rig.i2c, [&] { return recorder.callbacks > 0; }));
+    CHECK_EQ(rig.health().timeouts, 1u);
+    CHECK_EQ(rig.i2c.recoveryCount(), 1u);
+    CHECK_EQ(sim::Bus::instance().beginCount(), begins + 1);
+    CHECK_EQ(rig.data[0], 0x10);
+}
+
+TEST(stall_gives_up_after_timeout) {
+    BusRig rig;
+    Recorder recorder;
+    sim::Bus::instance().injectStall();
+    uint64_t start = sim::now();
+    rig.i2c.addTransfer(ScratchDevice::ADDRESS, 1, rig.reg, 2, rig.data, &recorder);
+    CHECK(pump(rig.i2c, [&] { return rig.i2c.recoveryCount() > 0; }, 100000, 1));
+    // BASE plus PER_BYTE for both address bytes, the register and two data bytes
+    uint32_t timeout = I2CManager::TRANSFER_TIMEOUT_BASE + 5 * I2CManager::TRANSFER_TIMEOUT_PER_BYTE;
+    CHECK(sim::now() - start >= timeout);
+    CHECK(sim::now() - start < timeout + 100);
+}
+
+TEST(long_read_does_not_time_out) {
+    // a full MPU9250 FIFO batch takes ~3.6ms on a 400kHz bus
+    BusRig rig;
+    Recorder recorder;
+    rig.i2c.addTransfer(ScratchDevice::ADDRESS, 1, rig.reg, 160, rig.data, &recorder);
+    CHECK(pump(rig.i2c, [&] { return recorder.callbacks > 0; }));
+    CHECK_EQ(recorder.last_count, 160);
+    CHECK_EQ(rig.health().timeouts, 0u);
+    CHECK_EQ(rig.i2c.recoveryCount(), 0u);
+    CHECK(sim::Bus::instance().log().back().end - sim::Bus::instance().log().back().start > 3500);
+}
+
+TEST(lost_arbitration_recovers_bus) {
+    BusRig rig;
+    Recorder recorder;
+    sim::Bus::instance().injectArbitrationLoss();
+    rig.i2c.addTransfer(ScratchDevice::ADDRESS, 1, rig.reg, 1, rig.data, &recorder);
+    CHECK(pump(rig.i2c, [&] { return recorder.callbacks > 0; }));
+    CHECK_EQ(rig.i2c.recoveryCount(), 1u);
+    CHECK_EQ(rig.health().errors, 1u);
+    CHECK_EQ(recorder.failures, 0u);
+}
+
+TEST(register_write_notifies_listener) {
+    BusRig rig;
+    Recorder listener;
+    I2CRegisterWrite write;
+    CHECK(rig.i2c.writeRegister(write, ScratchDevice::ADDRESS, 0x20, 0xAB, I2CPriority::Low, &listener));
+    CHECK(write.pending());
+    CHECK(!rig.i2c.writeRegister(write, ScratchDevice::ADDRESS, 0x20, 0xAC));  // still in flight
+    CHECK(pump(rig.i2c, [&] { return !write.pending(); }));
+    CHECK(write.status() == I2CRegisterWrite::Status::Done);
+    CHECK_EQ(rig.device.peek(0x20), 0xAB);
+    CHECK_EQ(listener.written, 1u);
+    CHECK_EQ(listener.last_value, 0xAB);
+}
+
+TEST(verified_write_retries_dropped_write) {
+    BusRig rig;
+    Recorder listener;
+    I2CRegisterWrite write;
+    rig.device.dropWrites(0x20, 1);
+    CHECK(rig.i2c.writeRegisterVerified(write, ScratchDevice::ADDRESS, 0x20, 0x55, I2CPriority::Low, &listener));
+    CHECK(pump(rig.i2c, [&] { return !write.pending(); }));
+    CHECK(write.status() == I2CRegisterWrite::Status::Done);
+    CHECK_EQ(write.mismatchCount(), 1u);
+    CHECK_EQ(rig.device.peek(0x20), 0x55);
+    CHECK_EQ(listener.written, 1u);
+    CHECK_EQ(listener.rejected, 0u);
+}
+
+TEST(verified_write_fails_when_never_held) {
+    BusRig rig;
+    Recorder listener;
+    I2CRegisterWrite write;
+    rig.device.dropWrites(0x20, 1000);
+    CHECK(rig.i2c.writeRegisterVerified(write, ScratchDevice::ADDRESS, 0x20, 0x55, I2CPriority::Low, &listener));
+    CHECK(pump(rig.i2c, [&] { return !write.pending(); }));
+    CHECK(write.status() == I2CRegisterWrite::Status::Failed);
+    CHECK_EQ(write.mismatchCount(), I2CManager::MAX_ATTEMPTS);
+    CHECK_EQ(listener.written, 0u);
+    CHECK_EQ(listener.rejected, 1u);
+}
+
+TEST(register_write_fails_on_dead_device) {
+    BusRig rig;
+    Recorder listener;
+    I2CRegisterWrite write;
+    sim::Bus::instance().injectNak(ScratchDevice::ADDRESS, I2CManager::MAX_ATTEMPTS);
+    CHECK(rig.i2c.writeRegister(write, ScratchDevice::ADDRESS, 0x20, 0x55, I2CPriority::Low, &listener));
+    CHECK(pump(rig.i2c, [&] { return !write.pending(); }));
+    CHECK(write.status() == I2CRegisterWrite::Status::Failed);
+    CHECK_EQ(rig.device.peek(0x20), 0x20);
+    CHECK_EQ(listener.rejected, 1u);
+}
+
+TEST(busy_percent_tracks_bus_time) {
+    BusRig rig;
+    Recorder recorder;
+    // one 22 byte read per millisecond: ~0.57ms of bus time each
+    uint64_t until = sim::now() + 2000000;
+    uint64_t next = sim::now();
+    while (sim::now() < until) {
+        if (sim::now() >= next && rig.i2c.transferQueue(I2CPriority::High).empty()) {
+            rig.i2c.addTransfer(ScratchDevice::ADDRESS, 1, rig.reg, 22, rig.data, &recorder, I2CPriority::High);
+            next += 1000;
+        }
+        rig.i2c.update();
+        sim::advance(10);
+    }
+    CHECK(rig.i2c.busyPercent() >= 50);
+    CHECK(rig.i2c.busyPercent() <= 70);
+}
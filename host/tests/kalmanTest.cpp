@@ -0,0 +1,167 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include "check.h"
+#include "kalman.h"
+#include "kalmanReference.h"
+
+namespace {
+
+// a climb with a swinging vertical acceleration, sampled like the flight loop: IMU at ~1kHz with some jitter, and
+// the barometer about every 38ms; noise from a fixed linear congruential generator so every run is the same
+struct Trace {
+    uint32_t seed{12345};
+    uint32_t step{0};
+    float time{0.0f};
+
+    float noise() {
+        seed = seed * 1664525u + 1013904223u;
+        return (float)(seed >> 8) / 16777216.0f - 0.5f;
+    }
+    float dt() {
+        return 0.001f + 0.0002f * noise();
+    }
+    float acceleration() {
+        return 0.8f * sinf(2.0f * time) + 0.05f * noise();
+    }
+    float elevation() {  // twice the integral of the acceleration above, from rest
+        return 0.4f * time - 0.2f * sinf(2.0f * time) + 0.1f * noise();
+    }
+    bool baroDue() {
+        return step % 38 == 37;
+    }
+};
+
+// standing still at an elevation known to within sqrt(elevation_variance); Localization starts from 1e30
+void initial(Matrix<3, 1> &state, SymmetricMatrix<3> &covar, float *ref_state, float *ref_covar, float elevation_variance) {
+    for (int i = 0; i < 3; ++i) {
+        state[i] = ref_state[i] = 0.0f;
+        for (int j = 0; j < 3; ++j)
+            ref_covar[i + 3 * j] = 0.0f;
+    }
+    covar(0, 0) = ref_covar[0] = elevation_variance;
+    covar(0, 1) = covar(0, 2) = covar(1, 2) = 0.0f;
+    covar(1, 1) = ref_covar[4] = 0.01f;
+    covar(2, 2) = ref_covar[8] = 0.01f;
+}
+
+double relative(float a, float b, float floor) {
+    return fabs((double)a - (double)b) / fmax(fmax(fabs((double)a), fabs((double)b)), (double)floor);
+}
+
+}  // namespace
+
+TEST(matches_the_dense_reference) {
+    // from a finite prior; the first fix from a 1e30 one is where the two updates part, see below
+    Matrix<3, 1> state;
+    SymmetricMatrix<3> covar;
+    float ref_state[3], ref_covar[9];
+    initial(state, covar, ref_state, ref_covar, 1.0f);
+    Trace trace;
+    double worst_state = 0, worst_covar = 0;
+    for (; trace.step < 10000; ++trace.step) {
+        float dt = trace.dt();
+        trace.time += dt;
+        se_kalman_predict(dt, state, covar);
+        referencePredict(dt, ref_state, ref_covar);
+        float a = trace.acceleration();
+        se_kalman_correct(state, covar, A_Z, a, ACC_VARIANCE);
+        referenceCorrect(ref_state, ref_covar, A_Z, a, ACC_VARIANCE);
+        if (trace.baroDue()) {
+            float z = trace.elevation();
+            se_kalman_correct(state, covar, P_Z, z, BARO_VARIANCE);
+            referenceCorrect(ref_state, ref_covar, P_Z, z, BARO_VARIANCE);
+        }
+        for (int i = 0; i < 3; ++i) {
+            worst_state = fmax(worst_state, relative(state[i], ref_state[i], 1e-2f));
+            for (int j = 0; j < 3; ++j)
+                worst_covar = fmax(worst_covar, relative(covar(i, j), ref_covar[i + 3 * j], 1e-4f));
+        }
+    }
+    CHECK(worst_state < 1e-4);
+    CHECK(worst_covar < 1e-4);
+}
+
+namespace {
+// the smallest principal minor of the covariance relative to the product of its diagonal terms, in double; below
+// zero means no Gaussian has this covariance
+double smallestMinor(const SymmetricMatrix<3> &p) {
+    double m[3][3];
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+            m[i][j] = p(i, j);
+    double smallest = fmin(m[0][0], fmin(m[1][1], m[2][2]));
+    for (int i = 0; i < 3; ++i)
+        for (int j = i + 1; j < 3; ++j)
+            smallest = fmin(smallest, (m[i][i] * m[j][j] - m[i][j] * m[i][j]) / (m[i][i] * m[j][j]));
+    double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[1][2]) - m[0][1] * (m[0][1] * m[2][2] - m[1][2] * m[0][2]) +
+                 m[0][2] * (m[0][1] * m[1][2] - m[1][1] * m[0][2]);
+    return fmin(smallest, det / (m[0][0] * m[1][1] * m[2][2]));
+}
+
+float traceOf(const SymmetricMatrix<3> &p) {
+    return p(0, 0) + p(1, 1) + p(2, 2);
+}
+}  // namespace
+
+TEST(first_fix_from_unknown_elevation) {
+    // P00 * R / (P00 + R) is R for P00 = 1e30; P -= K * H * P lands on the difference of two 1e30 terms instead
+    Matrix<3, 1> state;
+    SymmetricMatrix<3> covar;
+    float ref_state[3], ref_covar[9];
+    initial(state, covar, ref_state, ref_covar, 1e30f);
+    se_kalman_predict(0.001f, state, covar);
+    se_kalman_correct(state, covar, A_Z, 0.0f, ACC_VARIANCE);
+    se_kalman_correct(state, covar, P_Z, 12.0f, BARO_VARIANCE);
+    CHECK_NEAR(state[0], 12.0, 1e-4);
+    CHECK_NEAR(covar(0, 0), BARO_VARIANCE, 1e-6 * BARO_VARIANCE);
+    CHECK(smallestMinor(covar) >= 0.0);
+}
+
+TEST(trace_and_definiteness_over_a_flight) {
+    // 100s of flight from an unknown elevation, with the barometer far more precise than the default as well
+    const float baro_variances[] = {BARO_VARIANCE, 1e-7f};
+    for (float baro_variance : baro_variances) {
+        Matrix<3, 1> state;
+        SymmetricMatrix<3> covar;
+        float ref_state[3], ref_covar[9];
+        initial(state, covar, ref_state, ref_covar, 1e30f);
+        Trace trace;
+        double smallest = 1.0;
+        uint32_t grew = 0, shrank = 0;
+        float settled = 0.0f, drift = 0.0f;
+        for (; trace.step < 100000; ++trace.step) {
+            float dt = trace.dt();
+            trace.time += dt;
+            float before = traceOf(covar);
+            se_kalman_predict(dt, state, covar);
+            if (traceOf(covar) < before)
+                ++shrank;  // a prediction only adds uncertainty
+            before = traceOf(covar);
+            se_kalman_correct(state, covar, A_Z, trace.acceleration(), ACC_VARIANCE);
+            if (traceOf(covar) > before * (1.0f + 1e-6f))
+                ++grew;  // a correction only removes it
+            if (trace.baroDue()) {
+                before = traceOf(covar);
+                se_kalman_correct(state, covar, P_Z, trace.elevation(), baro_variance);
+                if (traceOf(covar) > before * (1.0f + 1e-6f))
+                    ++grew;
+            }
+            smallest = fmin(smallest, smallestMinor(covar));
+            if (trace.step == 50000 - 1)
+                settled = traceOf(covar);
+            else if (trace.step >= 50000)
+                drift = fmax(drift, fabsf(traceOf(covar) - settled) / settled);
+        }
+        CHECK(smallest >= 0.0);
+        CHECK_EQ(grew, 0u);
+        CHECK_EQ(shrank, 0u);
+        // the filter has settled into the cycle of its barometer period
+        CHECK(drift < 0.1f);
+    }
+}
@@ -0,0 +1,271 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include <vector>
+#include "check.h"
+#include "rig.h"
+
+TEST(who_am_i) {
+    SensorRig rig;
+    CHECK_EQ(rig.mpu.getID(), 0x71);
+}
+
+TEST(single_sample_is_converted_to_flyer_frame) {
+    SensorRig rig;
+    rig.mpu_model.setAccel(0, 0, 4096);  // 1g at +/-8g
+    rig.mpu_model.setGyro(3277, 0, -3277);  // 100 deg/s at +/-1000 deg/s
+    rig.start(false);
+    rig.run(20000);
+    CHECK(rig.imu_samples >= 18);
+    CHECK_NEAR(rig.state.accel[2], -1.0, 1e-4);  // ACCEL_ZSIGN
+    CHECK_NEAR(rig.state.accel[0], 0.0, 1e-6);
+    CHECK_NEAR(rig.state.gyro[0], 100.0, 0.01);
+    CHECK_NEAR(rig.state.gyro[2], -100.0, 0.01);
+}
+
+TEST(single_sample_is_stamped_with_data_ready_edge) {
+    SensorRig rig;
+    rig.mpu_model.setSamplePhase(137);
+    rig.start(false);
+    rig.run(10000);
+    uint32_t before = rig.imu_samples;
+    // stop right after a sample was handed to state
+    rig.run(5000, 1);
+    CHECK(rig.imu_samples > before);
+    uint32_t offset = (rig.mpu.sampleMicros() - 137) % rig.mpu_model.samplePeriod();
+    CHECK(offset <= 2);  // the ISR runs within a micros() call of the edge
+    CHECK_EQ(rig.mpu.lateCount(), 0u);
+    CHECK_EQ(rig.mpu.droppedCount(), 0u);
+}
+
+TEST(every_sample_is_read_without_fifo) {
+    SensorRig rig;
+    rig.start(false);
+    uint32_t first = rig.mpu_model.sampleCount();
+    rig.run(100000);
+    uint32_t produced = rig.mpu_model.sampleCount() - first;
+    CHECK(rig.imu_samples + 2 >= produced);
+    CHECK(rig.imu_samples <= produced + 1);
+}
+
+TEST(fifo_batches_deliver_every_sample) {
+    SensorRig rig;
+    rig.start(false, 4);
+    rig.run(10000);
+    uint32_t before = rig.imu_samples;
+    uint32_t produced_before = rig.mpu_model.sampleCount();
+    rig.run(100000);
+    uint32_t produced = rig.mpu_model.sampleCount() - produced_before;
+    uint32_t delivered = rig.imu_samples - before;
+    CHECK(delivered + 8 >= produced);
+    CHECK(delivered <= produced + 8);
+    CHECK_EQ(rig.mpu.droppedCount(), 0u);
+    CHECK_EQ(rig.mpu_model.fifoOverflows(), 0u);
+}
+
+TEST(fifo_samples_are_evenly_spaced) {
+    SensorRig rig;
+    rig.start(false, 4);
+    rig.run(10000);
+    uint32_t last = 0;
+    uint32_t spaced = 0, uneven = 0;
+    uint64_t until = sim::now() + 50000;
+    while (sim::now() < until) {
+        rig.i2c.update();
+        if (rig.mpu.ready) {
+            while (rig.mpu.nextSample()) {
+                if (last)
+                    ++(rig.mpu.sampleMicros() - last == MPU_SAMPLE_PERIOD ? spaced : uneven);
+                last = rig.mpu.sampleMicros();
+            }
+            rig.mpu.startMeasurement();
+        }
+        sim::advance(50);
+    }
+    CHECK(spaced >= 40);
+    CHECK_EQ(uneven, 0u);
+}
+
+TEST(fifo_overflow_is_reset) {
+    SensorRig rig;
+    rig.start(false, 4);
+    rig.run(10000);
+    // nobody reads for 600ms: the 512 byte FIFO holds 42 records and overflows
+    sim::advance(600000);
+    CHECK(rig.mpu_model.fifoOverflows() > 0);
+    rig.run(20000);
+    uint32_t before = rig.imu_samples;
+    rig.run(50000);
+    CHECK(rig.imu_samples - before >= 40);
+    CHECK(rig.mpu_model.fifoCount() < 12 * MPU9250::MAX_FIFO_BATCH);
+}
+
+TEST(failed_read_frees_driver) {
+    SensorRig rig;
+    rig.start(false);
+    rig.run(5000);
+    sim::Bus::instance().injectNak(MPU9250_ADDRESS, I2CManager::MAX_ATTEMPTS);
+    rig.run(5000);
+    CHECK(rig.mpu.ready || !rig.i2c.transferQueue(I2CPriority::High).empty());
+    uint32_t before = rig.imu_samples;
+    rig.run(10000);
+    CHECK(rig.imu_samples - before >= 8);
+}
+
+TEST(filter_setting_follows_confirmed_write) {
+    SensorRig rig;
+    rig.start(false);
+    CHECK_EQ(rig.mpu.accelDelayMicros(), 7800u);
+    CHECK(rig.mpu.setFilters(1, 5));
+    CHECK(!rig.mpu.setFilters(1, 5));  // still in flight
+    CHECK_EQ(rig.mpu.accelDelayMicros(), 7800u);  // not applied before the sensor holds it
+    rig.run(5000);
+    CHECK_EQ(rig.mpu.accelDelayMicros(), 35700u);
+    CHECK_EQ(rig.mpu_model.peek(sim::MPU9250Model::REG_ACCEL_CONFIG2), 5);
+    CHECK_EQ(rig.mpu_model.peek(sim::MPU9250Model::REG_CONFIG), 1);
+    CHECK_EQ(rig.mpu.configFailureCount(), 0u);
+}
+
+TEST(filter_settings_at_8khz_are_rejected) {
+    SensorRig rig;
+    rig.start(false);
+    uint8_t config = rig.mpu_model.peek(sim::MPU9250Model::REG_CONFIG);
+    CHECK(!rig.mpu.setFilters(0, 2));
+    CHECK(!rig.mpu.setFilters(7, 2));
+    CHECK(!rig.mpu.setFilters(1, 8));
+    rig.run(5000);
+    CHECK_EQ(rig.mpu_model.peek(sim::MPU9250Model::REG_CONFIG), config);
+    CHECK(rig.mpu.setFilters(6, 0));
+}
+
+TEST(filter_writes_are_queued_together_or_not_at_all) {
+    SensorRig rig;
+    rig.start(false);
+    // nothing polls the bus, so the low priority queue stays one slot short of both writes
+    uint8_t reg[1]{MPU9250_CONFIG};
+    uint8_t data[1];
+    while (rig.i2c.transferQueue(I2CPriority::Low).space() > 1)
+        rig.i2c.addTransfer(MPU9250_ADDRESS, 1, reg, 1, data, &rig.mpu, I2CPriority::Low);
+    uint8_t queued = rig.i2c.transferQueue(I2CPriority::Low).size();
+    CHECK(!rig.mpu.setFilters(1, 5));
+    CHECK_EQ(rig.i2c.transferQueue(I2CPriority::Low).size(), queued);
+}
+
+TEST(filter_setting_kept_when_write_fails) {
+    SensorRig rig;
+    rig.start(false);
+    CHECK(rig.mpu.setFilters(1, 5));
+    // every MPU9250 transfer NAKs until both writes gave up
+    sim::Bus::instance().injectNak(MPU9250_ADDRESS, 100);
+    rig.run(5000);
+    CHECK_EQ(rig.mpu.accelDelayMicros(), 7800u);
+    CHECK_EQ(rig.mpu.configFailureCount(), 2u);
+}
+
+TEST(magnetometer_data_rides_along) {
+    SensorRig rig;
+    rig.mag_model.setField(100, 200, 300);
+    rig.start(true);
+    rig.run(100000);
+    CHECK(rig.mag_model.measurementCount() >= 9);
+    // nothing on the main bus addressed the AK8963 once it sat behind the MPU9250
+    uint32_t direct = 0;
+    uint64_t attached = rig.mpu_model.lastSample() - 100000;
+    for (const sim::Bus::Transaction &t : sim::Bus::instance().log())
+        if (t.address == AK8963_ADDRESS && t.start > attached)
+            ++direct;
+    CHECK_EQ(direct, 0u);
+    // MAG_XDIR 1, MAG_YDIR 0, MAG_ZSIGN -1, with the default 128 sensitivity adjustment
+    const float mRes = 10.0f * 4912.0f / 32760.0f;
+    CHECK_NEAR(rig.state.mag[0] + CONFIG.data.magBias[0], 200 * mRes, 1e-3);
+    CHECK_NEAR(rig.state.mag[1] + CONFIG.data.magBias[1], 100 * mRes, 1e-3);
+    CHECK_NEAR(rig.state.mag[2] + CONFIG.data.magBias[2], -300 * mRes, 1e-3);
+}
+
+namespace {
+class Sink : public CallbackProcessor {
+   public:
+    void processCallback(uint8_t count, uint8_t *data) {
+        busy = false;
+    }
+    void processFailure() {
+        busy = false;
+    }
+    bool busy{false};
+};
+
+// numbers the samples through the gyro x register and remembers when each was taken
+struct NumberedSamples {
+    explicit NumberedSamples(SensorRig &rig) : rig(rig) {
+        rig.mpu_model.setMotion([this](uint32_t index, uint64_t time, int16_t accel[3], int16_t gyro[3]) {
+            taken.push_back(time);
+            gyro[0] = (int16_t)(index % 16384);
+        });
+    }
+    // the sample nextSample just handed to state was stamped with the time it was taken
+    bool stampMatches() {
+        const float gRes = 1000.0f / 32768.0f;
+        uint32_t index = (uint32_t)lroundf(rig.state.gyro[0] / gRes);
+        while (index + 16384 < taken.size())
+            index += 16384;
+        ++checked;
+        uint32_t offset = rig.mpu.sampleMicros() - (uint32_t)taken[index];
+        return offset <= 2;  // the ISR runs within a micros() call of the edge
+    }
+    SensorRig &rig;
+    std::vector<uint64_t> taken;
+    uint32_t checked{0};
+};
+}  // namespace
+
+TEST(single_read_is_stamped_with_the_sample_it_found) {
+    // every read waits ~4.5ms behind a long transfer, so it finds a sample newer than the edge that asked for it
+    SensorRig rig;
+    NumberedSamples numbered(rig);
+    rig.start(false);
+    rig.run(10000);
+    Sink sink;
+    uint8_t reg[1]{WHO_AM_I};
+    uint8_t hog[200];
+    uint32_t mismatched = 0;
+    uint64_t until = sim::now() + 100000;
+    while (sim::now() < until) {
+        rig.i2c.update();
+        if (rig.mpu.ready) {
+            while (rig.mpu.nextSample())
+                if (!numbered.stampMatches())
+                    ++mismatched;
+            if (!sink.busy)
+                sink.busy = rig.i2c.addTransfer(MPU9250_ADDRESS, 1, reg, 200, hog, &sink, I2CPriority::High);
+            rig.mpu.startMeasurement();
+        }
+        sim::advance(50);
+    }
+    CHECK(numbered.checked >= 15);
+    CHECK_EQ(mismatched, 0u);
+}
+
+TEST(fifo_samples_are_stamped_with_the_edges_before_the_count_read) {
+    // a slow loop: new samples often arrive between reading FIFO_COUNT and handling it
+    SensorRig rig;
+    NumberedSamples numbered(rig);
+    rig.start(false, 4);
+    rig.run(10000);
+    uint32_t mismatched = 0;
+    uint64_t until = sim::now() + 100000;
+    while (sim::now() < until) {
+        rig.i2c.update();
+        if (rig.mpu.ready) {
+            while (rig.mpu.nextSample())
+                if (!numbered.stampMatches())
+                    ++mismatched;
+            rig.mpu.startMeasurement();
+        }
+        sim::advance(370);
+    }
+    CHECK(numbered.checked >= 90);
+    CHECK_EQ(mismatched, 0u);
+}
@@ -0,0 +1,124 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <rig.h>
+
+    The sensor half of the flight controller on the simulated bus: the three sensor models, the drivers and the
+    I2CManager, started up and polled the way flybrix-firmware.ino does it.
+
+*/
+
+#ifndef tests_rig_h
+#define tests_rig_h
+
+#include "AK8963.h"
+#include "BMP280.h"
+#include "MPU9250.h"
+#include "config.h"
+#include "i2cManager.h"
+#include "state.h"
+
+#include "ak8963Model.h"
+#include "bmp280Model.h"
+#include "mpu9250Model.h"
+#include "sim.h"
+#include "wire.h"
+
+// calls i2c.update() every step microseconds until done() holds or limit microseconds passed
+template <typename Done>
+bool pump(I2CManager &i2c, Done done, uint32_t limit = 100000, uint32_t step = 10) {
+    uint64_t until = sim::now() + limit;
+    while (!done() && sim::now() < until) {
+        i2c.update();
+        sim::advance(step);
+    }
+    return done();
+}
+
+// CONFIG has to hold its defaults before State is built from it
+struct DefaultConfig {
+    DefaultConfig() {
+        initializeEEPROM();
+    }
+};
+
+struct SensorRig {
+    DefaultConfig config;
+    sim::MPU9250Model mpu_model{MPU_INTERRUPT};
+    sim::AK8963Model mag_model;
+    sim::BMP280Model bmp_model;
+
+    State state;
+    I2CManager i2c;
+    MPU9250 mpu{&state, &i2c};
+    AK8963 mag{&state, &i2c};
+    BMP280 bmp{&state, &i2c};
+
+    bool mag_direct{true};
+    uint32_t imu_samples{0};
+
+    SensorRig() {
+        sim::Bus &bus = sim::Bus::instance();
+        bus.add(&mpu_model);
+        bus.add(&bmp_model);
+        mpu_model.attachAuxiliary(&mag_model);
+        mag_model.setGate([this] { return mpu_model.bypassOpen(); });
+        bus.add(&mag_model);
+        sim::attach(&mpu_model);
+        sim::attach(&mag_model);
+        sim::attach(&bmp_model);
+        i2c.begin();
+    }
+
+    ~SensorRig() {
+        sim::detach(&mpu_model);
+        sim::detach(&mag_model);
+        sim::detach(&bmp_model);
+    }
+
+    // setup() without the serial, LED and motor parts; the magnetometer is read directly unless through_mpu
+    void start(bool through_mpu, uint8_t fifo_batch = 0) {
+        bmp.restart();
+        bmp.startMeasurement();
+        pump(i2c, [&] { return bmp.ready; });
+        bmp.newSample();
+        mpu.restart();
+        mag.restart();
+        if (through_mpu)
+            mpu.attachMagnetometer(&mag);
+        if (fifo_batch)
+            mpu.enableFifo(fifo_batch);
+        while (!mpu.startMeasurement())
+            delay(1);
+        mag_direct = !through_mpu;
+        if (mag_direct)
+            mag.startMeasurement();
+    }
+
+    // one pass of loop() over the sensors, every step microseconds, for duration microseconds
+    void run(uint32_t duration, uint32_t step = 50) {
+        uint64_t until = sim::now() + duration;
+        while (sim::now() < until) {
+            i2c.update();
+            if (mpu.ready) {
+                while (mpu.nextSample()) {
+                    state.updateStateIMU(mpu.sampleMicros());
+                    ++imu_samples;
+                }
+                mpu.startMeasurement();
+            }
+            if (bmp.ready) {
+                if (bmp.newSample())
+                    state.updateStatePT(bmp.sampleMicros());
+                bmp.startMeasurement();
+            }
+            if (mag_direct && mag.ready)
+                mag.startMeasurement();
+            sim::advance(step);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,108 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include <atomic>
+#include <thread>
+#include "check.h"
+#include "sampleRing.h"
+
+namespace {
+// every word derives from the sequence number, so a sample copied while it was being written shows up
+struct Sample {
+    uint32_t sequence;
+    uint32_t words[7];
+
+    void fill(uint32_t n) {
+        sequence = n;
+        for (uint32_t i = 0; i < 7; ++i)
+            words[i] = n * 2654435761u + i;
+    }
+    bool intact() const {
+        for (uint32_t i = 0; i < 7; ++i)
+            if (words[i] != sequence * 2654435761u + i)
+                return false;
+        return true;
+    }
+};
+}  // namespace
+
+TEST(holds_capacity_then_drops) {
+    SampleRing<Sample, 8> ring;
+    Sample sample;
+    for (uint32_t i = 0; i < 8; ++i) {
+        sample.fill(i);
+        CHECK(ring.push(sample));
+    }
+    sample.fill(8);
+    CHECK(!ring.push(sample));
+    CHECK_EQ(ring.droppedCount(), 1u);
+    CHECK_EQ(ring.size(), 8);
+    for (uint32_t i = 0; i < 8; ++i) {
+        CHECK(ring.pop(sample));
+        CHECK_EQ(sample.sequence, i);
+    }
+    CHECK(!ring.pop(sample));
+    CHECK_EQ(ring.size(), 0);
+}
+
+TEST(indices_wrap_around) {
+    // the 8 bit indices wrap many times over; size and order have to survive it
+    SampleRing<Sample, 4> ring;
+    Sample sample;
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < 1000; ++i) {
+        for (uint32_t k = 0; k < 1 + i % 4; ++k) {
+            sample.fill(i * 4 + k);
+            CHECK(ring.push(sample));
+        }
+        CHECK_EQ(ring.size(), 1 + i % 4);
+        while (ring.pop(sample)) {
+            CHECK_EQ(sample.sequence, i * 4 + next);
+            ++next;
+        }
+        next = 0;
+    }
+    CHECK_EQ(ring.droppedCount(), 0u);
+}
+
+TEST(threaded_producer_and_consumer) {
+    // the producer stands in for an interrupt, the consumer for the loop; it retries when the ring is full, so
+    // every sample has to come out once, whole and in order, whichever way the two threads interleave
+    const uint32_t count = 1000000;
+    SampleRing<Sample, 16> ring;
+    std::atomic<bool> done{false};
+    std::thread producer([&] {
+        Sample sample;
+        for (uint32_t n = 0; n < count; ++n) {
+            sample.fill(n);
+            while (!ring.push(sample))
+                std::this_thread::yield();
+        }
+        done.store(true, std::memory_order_release);
+    });
+
+    uint32_t popped = 0, torn = 0, out_of_order = 0;
+    Sample sample;
+    while (true) {
+        bool finished = done.load(std::memory_order_acquire);
+        while (ring.pop(sample)) {
+            if (!sample.intact())
+                ++torn;
+            if (sample.sequence != popped)
+                ++out_of_order;
+            popped = sample.sequence + 1;
+        }
+        if (finished)
+            break;
+        std::this_thread::yield();  // lets the producer in on a single core
+    }
+    producer.join();
+
+    CHECK_EQ(torn, 0u);
+    CHECK_EQ(out_of_order, 0u);
+    CHECK_EQ(popped, count);
+    CHECK_EQ(ring.size(), 0);
+}
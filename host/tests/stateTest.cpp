@@ -0,0 +1,83 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include "check.h"
+#include "rig.h"
+
+TEST(estimator_runs_after_a_late_reset) {
+    DefaultConfig config;
+    // past 2^31 microseconds of uptime, where a filter timed from zero sees every sample as older than its own clock
+    sim::advanceTo(36ull * 60 * 1000000);
+    State state;
+    state.resetState();
+    state.gyro[0] = 90.0f;  // deg/s, and no accel for the filter to pull back towards
+    float q[4];
+    for (uint8_t i = 0; i < 4; ++i)
+        q[i] = state.kinematicsQuaternion()[i];
+    for (uint16_t i = 0; i < 100; ++i) {
+        sim::advance(1000);
+        state.updateStateIMU(micros());
+    }
+    // a tenth of a second at 90 deg/s turns the attitude by ~9 degrees, so q moves by ~0.08
+    float moved = 0.0f;
+    for (uint8_t i = 0; i < 4; ++i)
+        moved += fabsf(state.kinematicsQuaternion()[i] - q[i]);
+    CHECK(moved > 0.05f);
+}
+
+// stateTest links with -Wl,--wrap=atan2f,--wrap=asinf, so every call the flight code makes comes through here
+namespace {
+uint32_t atan2f_calls = 0, asinf_calls = 0;
+}  // namespace
+
+extern "C" {
+float __real_atan2f(float y, float x);
+float __real_asinf(float x);
+float __wrap_atan2f(float y, float x) {
+    ++atan2f_calls;
+    return __real_atan2f(y, x);
+}
+float __wrap_asinf(float x) {
+    ++asinf_calls;
+    return __real_asinf(x);
+}
+}
+
+TEST(euler_angles_are_derived_only_when_read) {
+    DefaultConfig config;
+    State state;
+    state.resetState();
+    state.gyro[0] = 30.0f;
+    state.gyro[2] = -20.0f;
+    atan2f_calls = asinf_calls = 0;
+    for (uint16_t i = 0; i < 100; ++i) {
+        sim::advance(1000);
+        state.updateStateIMU(micros());
+    }
+    CHECK_EQ(atan2f_calls, 0u);  // the estimator itself never needs them
+    CHECK_EQ(asinf_calls, 0u);
+
+    // the controller reads all three and telemetry reads them again, from one conversion
+    float pitch = state.kinematicsAngle()[0];
+    float yaw = state.kinematicsAngle()[2];
+    state.kinematicsAngle();  // and telemetry
+    CHECK_EQ(atan2f_calls, 2u);
+    CHECK_EQ(asinf_calls, 1u);
+
+    // a FIFO batch of four samples ahead of one control pass
+    for (uint16_t i = 0; i < 4; ++i) {
+        sim::advance(1000);
+        state.updateStateIMU(micros());
+    }
+    CHECK_EQ(atan2f_calls, 2u);
+    state.kinematicsAngle();
+    state.kinematicsAngle();
+    CHECK_EQ(atan2f_calls, 4u);
+    CHECK_EQ(asinf_calls, 2u);
+    // still turning the way the gyro says
+    CHECK(state.kinematicsAngle()[0] > pitch);
+    CHECK(state.kinematicsAngle()[2] < yaw);
+}
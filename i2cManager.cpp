@@ -6,60 +6,174 @@
     *
 */
 
+#include "singlePrecision.h"
 #include "i2cManager.h"
 #include <i2c_t3.h>
+#include "timing.h"
 
-void I2CManager::addTransfer(uint8_t address, uint8_t send_count, uint8_t *send_data, uint8_t receive_count, uint8_t *receive_data, CallbackProcessor *cb_object) {
-    I2CTransfer *new_transfer = (I2CTransfer *)malloc(sizeof(I2CTransfer));
-    new_transfer->address = address;
-    new_transfer->send_count = send_count;
-    new_transfer->send_data = send_data;
-    new_transfer->receive_count = receive_count;
-    new_transfer->receive_data = receive_data;
-    new_transfer->cb_object = cb_object;
-    new_transfer->next = NULL;
-
-    if (!transfer) {
-        transfer = new_transfer;
-    } else {
-        I2CTransfer *last = transfer;
-        while (last->next) {
-            last = last->next;
-        }
-        last->next = new_transfer;
-    }
+bool I2CManager::addTransfer(uint8_t address, uint8_t send_count, uint8_t *send_data, uint8_t receive_count, uint8_t *receive_data, CallbackProcessor *cb_object,
+                             I2CPriority priority) {
+    return queues[uint8_t(priority)].push({address, send_count, send_data, receive_count, receive_data, cb_object, 0});
+}
+
+bool I2CManager::writeRegister(I2CRegisterWrite &write, uint8_t address, uint8_t subAddress, uint8_t data, I2CPriority priority,
+                               RegisterWriteListener *listener) {
+    return write.start(this, address, subAddress, data, false, priority, listener);
+}
+
+bool I2CManager::writeRegisterVerified(I2CRegisterWrite &write, uint8_t address, uint8_t subAddress, uint8_t data, I2CPriority priority,
+                                       RegisterWriteListener *listener) {
+    return write.start(this, address, subAddress, data, true, priority, listener);
+}
+
+void I2CManager::begin() {
+    // MPU9250 is limited to 400kHz bus speed.
+    Wire.begin(I2C_MASTER, 0x00, I2C_PINS_18_19, I2C_PULLUP_EXT, I2C_RATE_400);  // For I2C pins 18 and 19
 }
 
 void I2CManager::update() {
-    if (waiting_for_data) {
-        if (Wire.available() == transfer->receive_count) {
-            for (uint8_t i = 0; i < transfer->receive_count; i++) {
-                transfer->receive_data[i] = Wire.read();
-            }
-            transfer->cb_object->processCallback(transfer->receive_count, transfer->receive_data);
-
-            I2CTransfer *completed_transfer = transfer;
-            if (transfer->next) {
-                transfer = transfer->next;
-                free(completed_transfer);
-            } else {
-                free(transfer);
-                transfer = NULL;
-            }
-            waiting_for_data = false;
+    ScopedTiming timing(TimingProbe::I2CUpdate);
+    uint32_t now = micros();
+
+    if (bus_state != BusState::Idle && !Wire.done()) {
+        if (now - transfer_start < transfer_timeout)
+            return;  // the i2c_t3 interrupt handler is still moving bytes
+        // a slave is most likely holding the bus
+        recoverBus();
+        failTransfer(now, true);
+    }
+
+    if (bus_state == BusState::Sending) {
+        I2CTransfer &transfer = activeQueue().front();
+        if (Wire.status() != I2C_WAITING) {
+            if (Wire.status() == I2C_ARB_LOST)
+                recoverBus();
+            failTransfer(now, false);
+        } else if (transfer.receive_count > 0) {
+            Wire.sendRequest(transfer.address, transfer.receive_count, I2C_STOP);
+            bus_state = BusState::Receiving;
+            receive_start = now;
+            return;
+        } else {
+            I2CTransfer completed_transfer = transfer;
+            activeQueue().pop();
+            endTransfer(now);
+            if (completed_transfer.cb_object)
+                completed_transfer.cb_object->processCallback(0, completed_transfer.receive_data);
         }
-    } else if (transfer && !waiting_for_data) {
-        // begin new transfer
-        Wire.beginTransmission(transfer->address);
-        Wire.write(transfer->send_data, transfer->send_count);
-        uint8_t error = Wire.endTransmission();
-        if (error == 0 && transfer->receive_count > 0) {
-            waiting_for_data = true;
-            Wire.requestFrom(transfer->address, transfer->receive_count);
+    } else if (bus_state == BusState::Receiving) {
+        I2CTransfer &transfer = activeQueue().front();
+        if (Wire.status() != I2C_WAITING || Wire.available() != transfer.receive_count) {
+            if (Wire.status() == I2C_ARB_LOST)
+                recoverBus();
+            failTransfer(now, false);
         } else {
-            // how do we want to handle errors? ignore for now
+            for (uint8_t i = 0; i < transfer.receive_count; i++) {
+                transfer.receive_data[i] = Wire.read();
+            }
+            // pop before the callback so it can queue its next transfer into the freed slot
+            I2CTransfer completed_transfer = transfer;
+            activeQueue().pop();
+            endTransfer(now);
+            completed_transfer.cb_object->processCallback(completed_transfer.receive_count, completed_transfer.receive_data);
         }
     }
+
+    if (bus_state == BusState::Idle)
+        startTransfer(now);
+
+    if (now - busy_window_start >= 1000000) {
+        busy_percent = (uint8_t)(busy_in_window * 100 / (now - busy_window_start));
+        busy_in_window = 0;
+        busy_window_start = now;
+    }
+}
+
+void I2CManager::startTransfer(uint32_t now) {
+    uint8_t next = 0;
+    while (next < uint8_t(I2CPriority::Count) && queues[next].empty())
+        ++next;
+    if (next == uint8_t(I2CPriority::Count))
+        return;
+
+    passed_over[next] = 0;
+    for (uint8_t lower = next + 1; lower < uint8_t(I2CPriority::Count); ++lower) {
+        if (queues[lower].empty())
+            continue;
+        ++preemptions;
+        if (passed_over[lower] < STARVATION_LIMIT && ++passed_over[lower] == STARVATION_LIMIT)
+            ++starvations;
+    }
+    active_priority = next;
+
+    I2CTransfer &transfer = activeQueue().front();
+    Wire.beginTransmission(transfer.address);
+    Wire.write(transfer.send_data, transfer.send_count);
+    // keep the bus for a repeated start if we have to read the response
+    Wire.sendTransmission(transfer.receive_count > 0 ? I2C_NOSTOP : I2C_STOP);
+    bus_state = BusState::Sending;
+    transfer_start = now;
+    receive_start = now;
+    // both address bytes, the register and data written, and everything read back
+    transfer_timeout = TRANSFER_TIMEOUT_BASE + TRANSFER_TIMEOUT_PER_BYTE * (2 + transfer.send_count + transfer.receive_count);
+}
+
+void I2CManager::endTransfer(uint32_t now) {
+    busy_in_window += now - transfer_start;
+    ended_start = transfer_start;
+    ended_end = now;
+    ended_receive_start = receive_start;
+    bus_state = BusState::Idle;
+}
+
+void I2CManager::failTransfer(uint32_t now, bool timed_out) {
+    endTransfer(now);
+    I2CTransfer &transfer = activeQueue().front();
+    I2CDeviceHealth &device = health(transfer.address);
+    if (timed_out)
+        ++device.timeouts;
+    else
+        ++device.errors;
+
+    if (++transfer.attempts < MAX_ATTEMPTS)
+        return;  // stays at the head of its queue and is retried
+
+    // give up, so the rest of the queue does not stall behind a dead device
+    ++device.failures;
+    CallbackProcessor *cb_object = transfer.cb_object;
+    activeQueue().pop();
+    if (cb_object)
+        cb_object->processFailure();
+}
+
+void I2CManager::recoverBus() {
+    ++recoveries;
+    // clock out a slave stuck in the middle of a byte, then generate a STOP; lines are driven open-drain style
+    pinMode(I2C_SDA_PIN, INPUT);
+    pinMode(I2C_SCL_PIN, INPUT);
+    for (uint8_t i = 0; i < 9 && !digitalRead(I2C_SDA_PIN); ++i) {
+        pinMode(I2C_SCL_PIN, OUTPUT);
+        digitalWrite(I2C_SCL_PIN, LOW);
+        delayMicroseconds(5);
+        pinMode(I2C_SCL_PIN, INPUT);
+        delayMicroseconds(5);
+    }
+    pinMode(I2C_SDA_PIN, OUTPUT);
+    digitalWrite(I2C_SDA_PIN, LOW);
+    delayMicroseconds(5);
+    pinMode(I2C_SDA_PIN, INPUT);  // SDA rises while SCL is high
+    delayMicroseconds(5);
+    begin();
+}
+
+I2CDeviceHealth &I2CManager::health(uint8_t address) {
+    for (uint8_t i = 0; i < device_count; ++i)
+        if (devices[i].address == address)
+            return devices[i];
+    if (device_count == MAX_DEVICES)
+        return devices[MAX_DEVICES - 1];  // shared by any extra devices
+    devices[device_count] = {address, 0, 0, 0};
+    return devices[device_count++];
 }
 
 uint8_t I2CManager::readByte(uint8_t address, uint8_t subAddress) {
@@ -117,3 +231,59 @@ uint8_t I2CManager::writeByte(uint8_t address, uint8_t subAddress, uint8_t data)
     else
         return (0);
 }
+
+bool I2CRegisterWrite::start(I2CManager *__i2c, uint8_t __address, uint8_t subAddress, uint8_t data, bool __verify, I2CPriority __priority,
+                             RegisterWriteListener *__listener) {
+    if (pending())
+        return false;
+    i2c = __i2c;
+    listener = __listener;
+    address = __address;
+    priority = __priority;
+    verify = __verify;
+    attempts = 0;
+    data_to_send[0] = subAddress;
+    data_to_send[1] = data;
+    if (!queueWrite())
+        return false;
+    write_status = Status::Pending;
+    return true;
+}
+
+bool I2CRegisterWrite::queueWrite() {
+    ++attempts;
+    return i2c->addTransfer(address, 2, data_to_send, 0, nullptr, this, priority);
+}
+
+bool I2CRegisterWrite::queueReadBack() {
+    return i2c->addTransfer(address, 1, data_to_send, 1, data_to_read, this, priority);
+}
+
+void I2CRegisterWrite::processCallback(uint8_t count, uint8_t *data) {
+    if (count == 0) {  // the write went through
+        if (!verify)
+            finish(Status::Done);
+        else if (!queueReadBack())
+            finish(Status::Failed);
+        return;
+    }
+
+    if (data[0] == data_to_send[1]) {
+        finish(Status::Done);
+        return;
+    }
+    // some registers ignore writes while the device is busy, e.g. the BMP280 CONFIG register in normal mode
+    ++mismatches;
+    if (attempts >= I2CManager::MAX_ATTEMPTS || !queueWrite())
+        finish(Status::Failed);
+}
+
+void I2CRegisterWrite::processFailure() {
+    finish(Status::Failed);
+}
+
+void I2CRegisterWrite::finish(Status status) {
+    write_status = status;
+    if (listener)
+        listener->registerWritten(*this, status == Status::Done);
+}
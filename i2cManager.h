@@ -15,9 +15,23 @@
 #include "Arduino.h"
 #include <functional>
 
+#define I2C_SDA_PIN 18
+#define I2C_SCL_PIN 19
+
+class I2CRegisterWrite;
+
 class CallbackProcessor {
    public:
     virtual void processCallback(uint8_t count, uint8_t *data);
+    // the transfer was dropped after I2CManager::MAX_ATTEMPTS failed attempts; no data was read
+    virtual void processFailure() {
+    }
+};
+
+// told when a queued register write has settled, so the driver only trusts the new setting once the device holds it
+class RegisterWriteListener {
+   public:
+    virtual void registerWritten(const I2CRegisterWrite &write, bool success) = 0;
 };
 
 struct I2CTransfer {
@@ -27,27 +41,249 @@ struct I2CTransfer {
     uint8_t receive_count;
     uint8_t *receive_data;
     CallbackProcessor *cb_object;
-    I2CTransfer *next;
+    uint8_t attempts;
+};
+
+struct I2CDeviceHealth {
+    uint8_t address;
+    uint32_t errors;    // NAKs, lost arbitration and short reads
+    uint32_t timeouts;  // transfers that did not finish within their timeout
+    uint32_t failures;  // transfers dropped after MAX_ATTEMPTS
+};
+
+// fixed capacity circular queue; nothing is allocated after construction
+class I2CTransferQueue {
+   public:
+    static const uint8_t CAPACITY = 8;
+
+    bool push(const I2CTransfer &transfer) {
+        if (count == CAPACITY) {
+            ++overflows;
+            return false;
+        }
+        transfers[(head + count) % CAPACITY] = transfer;
+        if (++count > high_water)
+            high_water = count;
+        return true;
+    }
+
+    I2CTransfer &front() {
+        return transfers[head];
+    }
+
+    void pop() {
+        head = (head + 1) % CAPACITY;
+        --count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    uint8_t size() const {
+        return count;
+    }
+
+    uint8_t space() const {  // transfers that can still be pushed
+        return CAPACITY - count;
+    }
+
+    uint8_t highWater() const {
+        return high_water;
+    }
+
+    uint32_t overflowCount() const {
+        return overflows;
+    }
+
+   private:
+    I2CTransfer transfers[CAPACITY];
+    uint8_t head{0};
+    uint8_t count{0};
+    uint8_t high_water{0};
+    uint32_t overflows{0};
+};
+
+// the highest priority transfer is always started next; one in flight is never interrupted,
+// so a transfer waits for at most one lower priority transaction
+enum class I2CPriority : uint8_t {
+    High = 0,    // inertial data feeding the attitude estimator
+    Medium = 1,  // magnetometer
+    Low = 2,     // barometer and everything else
+    Count = 3,
 };
 
 class I2CManager {
    public:
+    // a waiting transfer passed over this many times is counted as starved
+    static const uint8_t STARVATION_LIMIT = 32;
+    static const uint8_t MAX_ATTEMPTS = 3;
+    // a transfer is abandoned once it has been on the bus for BASE + PER_BYTE * bytes microseconds;
+    // a byte takes 22.5us at 400kHz, so a 22 byte read needs ~550us and a 160 byte FIFO batch ~3.7ms
+    static const uint32_t TRANSFER_TIMEOUT_BASE = 1000;
+    static const uint32_t TRANSFER_TIMEOUT_PER_BYTE = 50;
+    static const uint8_t MAX_DEVICES = 4;
+
     I2CManager() {
-        waiting_for_data = false;
-        transfer = NULL;
     };
 
+    void begin();  // sets up the i2c_t3 driver; also used to restart it after a bus recovery
+
+    // never waits on the bus; advances the current transfer and runs callbacks of completed ones
     void update();
-    void addTransfer(uint8_t address, uint8_t send_count, uint8_t *send_data, uint8_t receive_count, uint8_t *receive_data, CallbackProcessor *cb_object);
+    // returns false if the queue is full and the transfer was dropped
+    bool addTransfer(uint8_t address, uint8_t send_count, uint8_t *send_data, uint8_t receive_count, uint8_t *receive_data, CallbackProcessor *cb_object,
+                     I2CPriority priority = I2CPriority::Low);
+
+    // queue a single register write; returns false if the write is still in flight or the queue is full
+    bool writeRegister(I2CRegisterWrite &write, uint8_t address, uint8_t subAddress, uint8_t data, I2CPriority priority = I2CPriority::Low,
+                       RegisterWriteListener *listener = nullptr);
+    // as above, then read the register back and write again until it holds the value or MAX_ATTEMPTS is reached
+    bool writeRegisterVerified(I2CRegisterWrite &write, uint8_t address, uint8_t subAddress, uint8_t data, I2CPriority priority = I2CPriority::Low,
+                               RegisterWriteListener *listener = nullptr);
+
+    const I2CTransferQueue &transferQueue(I2CPriority priority) const {
+        return queues[uint8_t(priority)];
+    }
+
+    uint32_t preemptionCount() const {  // transfers started while a lower priority one was waiting
+        return preemptions;
+    }
+
+    uint32_t starvationCount() const {  // transfers that waited STARVATION_LIMIT dispatches or more
+        return starvations;
+    }
+
+    uint32_t recoveryCount() const {
+        return recoveries;
+    }
+
+    uint8_t deviceCount() const {
+        return device_count;
+    }
+
+    const I2CDeviceHealth &deviceHealth(uint8_t index) const {
+        return devices[index];
+    }
+
+    uint8_t busyPercent() const {  // share of the last second spent with a transfer on the bus
+        return busy_percent;
+    }
+
+    // when the transfer that ended last, e.g. the one whose callback is running, went out and finished; a transfer
+    // can wait in its queue much longer than it takes, so stamp data with these rather than with the queueing time
+    uint32_t transferStartMicros() const {
+        return ended_start;
+    }
+
+    uint32_t transferEndMicros() const {
+        return ended_end;
+    }
+
+    // when its read went out, a poll after the register address was written; the device sends what it held then
+    uint32_t receiveStartMicros() const {
+        return ended_receive_start;
+    }
+
+    // blocking helpers, only meant for setup and configuration
 
     uint8_t readByte(uint8_t address, uint8_t subAddress);
     uint8_t readBytes(uint8_t address, uint8_t subAddress, uint8_t count, uint8_t *dest);
     uint8_t writeByte(uint8_t address, uint8_t subAddress, uint8_t data);
 
    private:
-    I2CTransfer *transfer;
-    bool waiting_for_data;
+    enum class BusState : uint8_t {
+        Idle,
+        Sending,    // register address (and data) being written
+        Receiving,  // reading the response after a repeated start
+    };
+
+    void startTransfer(uint32_t now);
+    void endTransfer(uint32_t now);
+    void failTransfer(uint32_t now, bool timed_out);
+    void recoverBus();
+    I2CDeviceHealth &health(uint8_t address);
+
+    I2CTransferQueue &activeQueue() {
+        return queues[active_priority];
+    }
+
+    I2CTransferQueue queues[uint8_t(I2CPriority::Count)];
+    uint8_t passed_over[uint8_t(I2CPriority::Count)]{0};
+    uint8_t active_priority{0};
+    uint32_t preemptions{0};
+    uint32_t starvations{0};
+    uint32_t recoveries{0};
+    BusState bus_state{BusState::Idle};
+
+    I2CDeviceHealth devices[MAX_DEVICES];
+    uint8_t device_count{0};
+
+    uint32_t transfer_start{0};
+    uint32_t transfer_timeout{0};
+    uint32_t receive_start{0};
+    uint32_t ended_start{0};
+    uint32_t ended_end{0};
+    uint32_t ended_receive_start{0};
+    uint32_t busy_window_start{0};
+    uint32_t busy_in_window{0};
+    uint8_t busy_percent{0};
 
 };  // class I2CManager
 
+// a register write that goes through the transfer queues, so it can be issued while flying;
+// owns its buffers, the driver keeps one per register it reconfigures at runtime
+class I2CRegisterWrite : public CallbackProcessor {
+   public:
+    enum class Status : uint8_t {
+        Idle,
+        Pending,
+        Done,
+        Failed,  // the bus dropped it, or a verified write never read back the value
+    };
+
+    // the listener, if any, is told once the write is Done or Failed
+    bool start(I2CManager *i2c, uint8_t address, uint8_t subAddress, uint8_t data, bool verify, I2CPriority priority, RegisterWriteListener *listener);
+
+    void processCallback(uint8_t count, uint8_t *data);
+    void processFailure();
+
+    Status status() const {
+        return write_status;
+    }
+
+    bool pending() const {
+        return write_status == Status::Pending;
+    }
+
+    uint8_t subAddress() const {
+        return data_to_send[0];
+    }
+
+    uint8_t value() const {  // the value written, held by the device once the status is Done
+        return data_to_send[1];
+    }
+
+    uint32_t mismatchCount() const {  // read backs that did not match the written value
+        return mismatches;
+    }
+
+   private:
+    bool queueWrite();
+    bool queueReadBack();
+    void finish(Status status);
+
+    I2CManager *i2c{nullptr};
+    RegisterWriteListener *listener{nullptr};
+    uint8_t address{0};
+    I2CPriority priority{I2CPriority::Low};
+    bool verify{false};
+    uint8_t attempts{0};
+    Status write_status{Status::Idle};
+    uint32_t mismatches{0};
+
+    uint8_t data_to_send[2]{0};  // register, value
+    uint8_t data_to_read[1];
+};  // class I2CRegisterWrite
+
 #endif
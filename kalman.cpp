@@ -1,50 +1,66 @@
+#include "singlePrecision.h"
 #include "kalman.h"
-#include "lapack.h"
 
-void se_kalman_predict(float deltaTime, float* state, float* covar) {
-    float F[9] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f};
-    static const float Q[9] = {0.06f, 0.0f, 0.0f, 0.0f, 0.04f, 0.0f, 0.0f, 0.0f, 0.01f};
-    static const int n = 3;
-    static const float f_one = 1.0f, f_zero = 0.0f;
-    float buffer[9];
+void se_kalman_predict(float deltaTime, Matrix<3, 1>& state, SymmetricMatrix<3>& covar) {
+    /* diagonal of Q */
+    static const float q0 = 0.06f, q1 = 0.04f, q2 = 0.01f;
 
     if (!(deltaTime > 0.0f))
         return;
 
-    /* p += v * dt + a * dt * dt / 2; F[0] = 1, F[3] = dt, F[6] = dt * dt / 2 */
-    F[3] = deltaTime;
-    F[6] = deltaTime * deltaTime * 0.5f;
-    state[0] += F[3] * state[1] + F[6] * state[2];
-    /* v += a * dt; F[1] = 0, F[4] = 1, F[7] = dt */
-    F[7] = deltaTime;
-    state[1] += F[7] * state[2];
+    /*
+     *     | 1  dt  h  |
+     * F = | 0  1   dt |, h = dt * dt / 2
+     *     | 0  0   1  |
+     */
+    float dt = deltaTime;
+    float h = deltaTime * deltaTime * 0.5f;
+
+    /* p += v * dt + a * h; v += a * dt */
+    state[0] += dt * state[1] + h * state[2];
+    state[1] += dt * state[2];
 
-    /* buffer = P * F' */
-    Fgemm_("n", "t", &n, &n, &n, &f_one, covar, &n, F, &n, &f_zero, buffer, &n);
+    /* P = F * P * F' + dt * Q, expanded for the structure of F; only the upper triangle is computed */
+    float p00 = covar(0, 0), p01 = covar(0, 1), p02 = covar(0, 2);
+    float p11 = covar(1, 1), p12 = covar(1, 2), p22 = covar(2, 2);
 
-    /* P = Q */
-    Flacpy_(" ", &n, &n, Q, &n, covar, &n);
+    /* F * P, upper two rows; the last row of F * P is the last row of P */
+    float a00 = p00 + dt * p01 + h * p02;
+    float a01 = p01 + dt * p11 + h * p12;
+    float a02 = p02 + dt * p12 + h * p22;
+    float a11 = p11 + dt * p12;
+    float a12 = p12 + dt * p22;
 
-    /* P = F * buffer + dT * P = F * P * F' + dt * Q */
-    Fgemm_("n", "n", &n, &n, &n, &f_one, F, &n, buffer, &n, &deltaTime, covar, &n);
+    covar(0, 0) = a00 + dt * a01 + h * a02 + dt * q0;
+    covar(0, 1) = a01 + dt * a02;
+    covar(0, 2) = a02;
+    covar(1, 1) = a11 + dt * a12 + dt * q1;
+    covar(1, 2) = a12;
+    covar(2, 2) = p22 + dt * q2;
 }
 
-void se_kalman_correct(float* state, float* covar, int coordinate, float value, float variance) {
-    static const int n = 3, i_one = 1;
-    static const float f_one = 1.0f, f_minus_one = -1.0f;
+void se_kalman_correct(Matrix<3, 1>& state, SymmetricMatrix<3>& covar, int coordinate, float value, float variance) {
     float y = value - state[coordinate];
-    float k_opt[3], h_row[3];
-    float s_inverse = 1.0f / (covar[coordinate * 4] + variance);
-    int i;
-    for (i = 0; i < 3; ++i) {
-        k_opt[i] = covar[i + coordinate * 3] * s_inverse;
+    Matrix<3, 1> k_opt;
+    float s_inverse = 1.0f / (covar(coordinate, coordinate) + variance);
+    for (int i = 0; i < 3; ++i) {
+        k_opt[i] = covar(i, coordinate) * s_inverse;
         state[i] += k_opt[i] * y;
-        h_row[i] = covar[coordinate + 3 * i];
     }
     /*
-     * P -= K * H * P
+     * Joseph form: P = (I - K * H) * P * (I - K * H)' + K * R * K'
+     * P -= K * H * P is the same in exact arithmetic, but it subtracts two nearly equal terms, and the round-off
+     * can leave P indefinite, e.g. P00 ~ 0 after the first fix from a 1e30 prior; this sums two positive
+     * semidefinite terms instead, a congruence of P and a rank one update, so round-off stays at the size of P's terms
      * H has 1 row and 3 columns with value col == coordinate ? 1 : 0
-     * Thus, H * P is the "coordinate"-th row of P
+     * Thus, (I - K * H) * P takes K times the "coordinate"-th row of P off P, and the product with (I - K * H)'
+     * takes the result's "coordinate"-th column times K' off that
      */
-    Fgemm_("n", "n", &n, &n, &i_one, &f_minus_one, k_opt, &n, h_row, &i_one, &f_one, covar, &n);
+    Matrix<3, 3> a;
+    for (int col = 0; col < 3; ++col)
+        for (int row = 0; row < 3; ++row)
+            a(row, col) = covar(row, col) - k_opt[row] * covar(coordinate, col);
+    for (int col = 0; col < 3; ++col)
+        for (int row = 0; row <= col; ++row)
+            covar(row, col) = a(row, col) - a(row, coordinate) * k_opt[col] + variance * k_opt[row] * k_opt[col];
 }
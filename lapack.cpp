@@ -1,3 +1,4 @@
+#include "singlePrecision.h"
 #include "lapack.h"
 
 #include <cmath>
@@ -9,7 +10,7 @@ void Fgemm_(const char* trans_a, const char* trans_b, const int* m, const int* n
     int* a_2 = *trans_a == 't' ? &i1 : &i3;
     int* b_1 = *trans_b == 't' ? &i2 : &i3;
     int* b_2 = *trans_b == 't' ? &i3 : &i2;
-    beta_is_null = *beta == 0.0;
+    beta_is_null = *beta == 0.0f;
     for (i1 = 0; i1 < *m; ++i1)
         for (i2 = 0; i2 < *n; ++i2) {
             c_pos = i1 + i2 * *ldc;
@@ -26,7 +27,7 @@ void Fgemv_(const char* trans, const int* m, const int* n, const float* alpha, c
     int i1, i3, beta_is_null, y_pos;
     int* a_1 = *trans == 't' ? &i3 : &i1;
     int* a_2 = *trans == 't' ? &i1 : &i3;
-    beta_is_null = *beta == 0.0;
+    beta_is_null = *beta == 0.0f;
     for (i1 = 0; i1 < *m; ++i1) {
         y_pos = i1 * *incy;
         if (beta_is_null)
@@ -74,9 +75,9 @@ int dpotrf_help_(int n, float* a, int ld1, int ld2) {
             helper = a[i1 * ld1 + i2 * ld2];
             a[curr_pos] -= helper * helper;
         }
-        if (!(a[curr_pos] > 0.0))
+        if (!(a[curr_pos] > 0.0f))
             return 1;
-        a[curr_pos] = sqrt(a[curr_pos]);
+        a[curr_pos] = sqrtf(a[curr_pos]);
     }
     return 0;
 }
@@ -99,7 +100,7 @@ void Fgetrf_swap_rows_(int cols, float* a, int lda, int r1, int r2) {
 }
 
 float abs_val(float x) {
-    return (x < 0.0) ? -x : x;
+    return (x < 0.0f) ? -x : x;
 }
 
 void Fgetrf_pivotize_(int m, int n, float* a, int lda, int* ipiv) {
@@ -145,7 +146,7 @@ void Fgetrf_(const int* m, const int* n, float* a, const int* lda, int* ipiv, in
             for (k = 0; k < i; ++k)
                 a[i + j * *lda] -= a[k + j * *lda] * a[i + k * *lda];
         }
-        if (a[j + j * *lda] == 0.0 || a[j + j * *lda] == -0.0) {
+        if (a[j + j * *lda] == 0.0f || a[j + j * *lda] == -0.0f) {
             *info = 1;
             return;
         }
@@ -175,7 +176,7 @@ void Fgetri_(const int* n, float* a, const int* lda, const int* ipiv, float* wor
         workspace[i * (*n + 1)] = 1;
 
     for (i = 0; i < *n; ++i)
-        if (a[i * (*lda + 1)] == 0.0 || a[i * (*lda + 1)] == -0.0) {
+        if (a[i * (*lda + 1)] == 0.0f || a[i * (*lda + 1)] == -0.0f) {
             *info = 1;
             return;
         }
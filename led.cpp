@@ -6,6 +6,7 @@
 
 //#define LED_SERIAL_DEBUG
 
+#include "singlePrecision.h"
 #include "led.h"
 #include "state.h"
 
@@ -1,7 +1,9 @@
+#include "singlePrecision.h"
 #include "localization.h"
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include "ahrs.h"
 #include "kalman.h"
 
@@ -24,7 +26,7 @@ void se_compensate_imu_acc_offsets(const float q[4], float gravity, float acc[3]
     acc[2] += gravity * (q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3]);
 }
 
-void se_compensate_imu(float delta_time, FilterType type, const float parameters[], IMUState* state, float gyro[3], float acc[3], float mag[3], int use_mag) {
+void se_compensate_imu(float delta_time, FilterType type, const float parameters[], IMUState* state, float gyro[3], const float acc[3], float mag[3], int use_mag) {
     se_compensate_imu_gyro_offsets(state->gyro_drift, gyro);
 
     switch (type) {
@@ -41,8 +43,6 @@ void se_compensate_imu(float delta_time, FilterType type, const float parameters
                 se_mahony_ahrs_update_imu(gyro[0], gyro[1], gyro[2], acc[0], acc[1], acc[2], delta_time, parameters[0], parameters[1], state->fb_i, state->q);
             break;
     }
-
-    se_compensate_imu_acc_offsets(state->q, state->gravity, acc);
 }
 
 float getVerticalAcceleration(const float* q, const float* v) {
@@ -65,10 +65,11 @@ Localization::Localization(float deltaTime, FilterType ahrsType, const float* ah
 
 Localization::Localization(float q0, float q1, float q2, float q3, float deltaTime, FilterType ahrsType, const float* ahrsParameters, float elevationVariance)
     : imuState{{0.0f, 0.0f, 0.0f}, 0.0f, 0.0f, {q0, q1, q2, q3}, {0.0f, 0.0f, 0.0f}},
-      z{0.0, 0.0, 0.0},
-      zCovar{1e30f, 0.0f, 0.0f, 0.0f, 0.01f, 0.0f, 0.0f, 0.0f, 0.01f},
+      z{{0.0f, 0.0f, 0.0f}},
+      zCovar{{1e30f, 0.0f, 0.01f, 0.0f, 0.0f, 0.01f}},
       magLastMeas{0.0f, 0.0f, 0.0f},
       hasMagMeas{false},
+      magTime(0),
       deltaTime(deltaTime),
       ahrsParameters(ahrsParameters),
       elevationVariance(elevationVariance),
@@ -77,9 +78,18 @@ Localization::Localization(float q0, float q1, float q2, float q3, float deltaTi
     setGravityEstimate(9.81f);
 }
 
-void Localization::ProcessMeasurementElevation(unsigned int time, float elevation) {
-    se_kalman_predict((time - timeNow) / 1000000.0f, z, zCovar);
+float Localization::advanceTime(unsigned int time) {
+    // sensors are read independently, so their samples do not always arrive in capture order
+    int32_t elapsed = (int32_t)(time - timeNow);
+    if (elapsed <= 0)
+        return 0.0f;
     timeNow = time;
+    return elapsed / 1000000.0f;
+}
+
+void Localization::ProcessMeasurementElevation(unsigned int time, float elevation) {
+    // a barometer sample after a long gap, e.g. the first one, must not push the covariance out of range
+    se_kalman_predict(std::min(advanceTime(time), 4.0f * deltaTime), z, zCovar);
     se_kalman_correct(z, zCovar, SE_STATE_P_Z, elevation, elevationVariance);
 }
 
@@ -87,23 +97,28 @@ void Localization::ProcessMeasurementPT(unsigned int time, float p_sl, float p,
     ProcessMeasurementElevation(time, calculateElevation(p_sl, p, t));
 }
 
-void Localization::ProcessMeasurementIMU(unsigned int time, const float* gyroscope, const float* accelerometer) {
+void Localization::ProcessMeasurementIMU(unsigned int time, const float* gyroscope, const float* accelAttitude, const float* accelVertical) {
     float gyroCorrected[3];
-    float accelCorrected[3];
-    float deltaTime = (time - timeNow) / 1000000.0f;
-    deltaTime = std::min(deltaTime, 4.0f * this->deltaTime);
+    float accelAttitudeCorrected[3];
+    float accelVerticalCorrected[3];
+    float deltaTime = std::min(advanceTime(time), 4.0f * this->deltaTime);
+    // a magnetometer sample captured after this IMU sample waits for the next one
+    bool useMag = hasMagMeas && (int32_t)(time - magTime) >= 0;
     for (int i = 0; i < 3; ++i) {
         gyroCorrected[i] = gyroscope[i];
-        accelCorrected[i] = accelerometer[i] * 9.81f;
+        accelAttitudeCorrected[i] = accelAttitude[i] * 9.81f;
+        accelVerticalCorrected[i] = accelVertical[i] * 9.81f;
     }
-    se_compensate_imu(deltaTime, ahrsType, ahrsParameters, &imuState, gyroCorrected, accelCorrected, magLastMeas, hasMagMeas);
-    hasMagMeas = false;
+    se_compensate_imu(deltaTime, ahrsType, ahrsParameters, &imuState, gyroCorrected, accelAttitudeCorrected, magLastMeas, useMag);
+    if (useMag)
+        hasMagMeas = false;
+    se_compensate_imu_acc_offsets(imuState.q, imuState.gravity, accelVerticalCorrected);
     se_kalman_predict(deltaTime, z, zCovar);
-    timeNow = time;
-    se_kalman_correct(z, zCovar, SE_STATE_A_Z, getVerticalAcceleration(imuState.q, accelCorrected), SE_ACC_VARIANCE);
+    se_kalman_correct(z, zCovar, SE_STATE_A_Z, getVerticalAcceleration(imuState.q, accelVerticalCorrected), SE_ACC_VARIANCE);
 }
 
-void Localization::ProcessMeasurementMagnetometer(const float* magnetometer) {
+void Localization::ProcessMeasurementMagnetometer(unsigned int time, const float* magnetometer) {
+    magTime = time;
     for (int i = 0; i < 3; ++i)
         magLastMeas[i] = magnetometer[i];
     hasMagMeas = true;
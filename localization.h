@@ -1,6 +1,8 @@
 #ifndef SE_LOCALIZATION_H_
 #define SE_LOCALIZATION_H_
 
+#include "matrix.h"
+
 struct IMUState {
     float gyro_drift[3];
     float gravity_filter_weight;
@@ -22,9 +24,10 @@ class Localization {
 
     void ProcessMeasurementPT(unsigned int time, float p_sl, float p, float t);
 
-    void ProcessMeasurementIMU(unsigned int time, const float* gyroscope, const float* accelerometer);
+    // the attitude filter is corrected with accelAttitude, the altitude filter with accelVertical
+    void ProcessMeasurementIMU(unsigned int time, const float* gyroscope, const float* accelAttitude, const float* accelVertical);
 
-    void ProcessMeasurementMagnetometer(const float* magnetometer);
+    void ProcessMeasurementMagnetometer(unsigned int time, const float* magnetometer);
 
     void setTime(unsigned int time);
 
@@ -37,11 +40,15 @@ class Localization {
     float getElevation() const;
 
    private:
+    // seconds since the newest measurement so far; zero for one older than that, which is applied as if current
+    float advanceTime(unsigned int time);
+
     IMUState imuState;
-    float z[3];
-    float zCovar[9];
+    Matrix<3, 1> z;
+    SymmetricMatrix<3> zCovar;
     float magLastMeas[3];
     bool hasMagMeas;
+    unsigned int magTime;
 
     float deltaTime;
     const float* ahrsParameters;
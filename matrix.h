@@ -0,0 +1,49 @@
+#ifndef SE_MATRIX_H_
+#define SE_MATRIX_H_
+
+/*
+ * Fixed size matrices for the state estimator
+ * Stored column major like the BLAS style routines in lapack.h. Every dimension is a
+ * template parameter, so there is no runtime dispatch; the filter writes its updates
+ * out element by element in kalman.cpp, where the structure of F and H is known.
+ */
+template <int R, int C>
+struct Matrix {
+    float data[R * C];
+
+    float& operator()(int row, int col) {
+        return data[row + R * col];
+    }
+
+    const float& operator()(int row, int col) const {
+        return data[row + R * col];
+    }
+
+    float& operator[](int index) {
+        return data[index];
+    }
+
+    const float& operator[](int index) const {
+        return data[index];
+    }
+};
+
+/*
+ * Symmetric N x N matrix, storing only the upper triangle column by column:
+ * (0,0) (0,1) (1,1) (0,2) (1,2) (2,2) ...
+ * Both (r,c) and (c,r) address the same element, so symmetry cannot be lost.
+ */
+template <int N>
+struct SymmetricMatrix {
+    float data[N * (N + 1) / 2];
+
+    float& operator()(int row, int col) {
+        return row <= col ? data[row + col * (col + 1) / 2] : data[col + row * (row + 1) / 2];
+    }
+
+    const float& operator()(int row, int col) const {
+        return row <= col ? data[row + col * (col + 1) / 2] : data[col + row * (row + 1) / 2];
+    }
+};
+
+#endif /* end of include guard: SE_MATRIX_H_ */
@@ -4,6 +4,7 @@
     *  License and other details available at: http://www.flybrix.com/firmware
 */
 
+#include "singlePrecision.h"
 #include "power.h"
 #include "state.h"
 
@@ -39,7 +40,7 @@ float PowerMonitor::getTotalPower(void) {
 }
 
 float PowerMonitor::getElectronicsPower(void) {
-    return getI1() * 3.7;
+    return getI1() * 3.7f;
 }
 
 uint16_t PowerMonitor::getV0Raw(void) {
@@ -56,15 +57,15 @@ uint16_t PowerMonitor::getI1Raw(void) {
 
 float PowerMonitor::getV0(void) {
     // Volts = (20.5 + 226) / 20.5 * 1.2 / 65536 * raw
-    return 0.00022017316 * getV0Raw();
+    return 0.00022017316f * getV0Raw();
 }
 
 float PowerMonitor::getI0(void) {
     // Amps = (1/50) / 0.003 * 1.2 / 65536 * raw
-    return 0.00012207031 * getI0Raw();
+    return 0.00012207031f * getI0Raw();
 }
 
 float PowerMonitor::getI1(void) {
     // Amps = (1/50) / 0.03 * 1.2 / 65536 * raw
-    return 0.00001220703 * getI1Raw();
+    return 0.00001220703f * getI1Raw();
 }
@@ -0,0 +1,60 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <sampleRing.h>
+
+    Single producer, single consumer ring of sensor samples that needs no locking.
+
+*/
+
+#ifndef sampleRing_h
+#define sampleRing_h
+
+#include <atomic>
+#include <stdint.h>
+
+// push() may run in an interrupt or callback while pop() runs in the loop; each index is written by one side only,
+// and the release/acquire pairs make a sample visible before the index that publishes it
+template <typename T, uint8_t N>
+class SampleRing {
+    static_assert(N > 0 && N <= 128 && (N & (N - 1)) == 0, "capacity must be a power of two, at most 128");
+
+   public:
+    bool push(const T &sample) {  // producer side; false and counted if the consumer fell a full ring behind
+        uint8_t write_index = head.load(std::memory_order_relaxed);
+        if ((uint8_t)(write_index - tail.load(std::memory_order_acquire)) == N) {
+            ++dropped;
+            return false;
+        }
+        samples[write_index % N] = sample;
+        head.store(write_index + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &sample) {  // consumer side
+        uint8_t read_index = tail.load(std::memory_order_relaxed);
+        if (read_index == head.load(std::memory_order_acquire))
+            return false;
+        sample = samples[read_index % N];
+        tail.store(read_index + 1, std::memory_order_release);
+        return true;
+    }
+
+    uint8_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    uint32_t droppedCount() const {
+        return dropped;
+    }
+
+   private:
+    T samples[N];
+    std::atomic<uint8_t> head{0};  // written by the producer
+    std::atomic<uint8_t> tail{0};  // written by the consumer
+    uint32_t dropped{0};
+};
+
+#endif
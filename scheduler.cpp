@@ -0,0 +1,73 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include "singlePrecision.h"
+#include "scheduler.h"
+
+namespace {
+// signed distance handles the micros() rollover every ~71 minutes
+inline int32_t timeUntil(uint32_t deadline, uint32_t now) {
+    return (int32_t)(deadline - now);
+}
+}
+
+bool Scheduler::addTask(TaskFunction function, uint32_t period, uint32_t phase, uint32_t budget, CatchUp policy) {
+    if (task_count >= MAX_TASKS || period == 0)
+        return false;
+    tasks[task_count++] = {function, period, phase, budget, policy, phase, 0, 0, 0, {}};
+    return true;
+}
+
+void Scheduler::start(uint32_t now) {
+    for (uint8_t i = 0; i < task_count; ++i)
+        tasks[i].deadline = now + tasks[i].phase;
+}
+
+bool Scheduler::run(uint32_t now) {
+    uint32_t tried = 0;  // bitmask of tasks that were not ready during this call
+
+    while (true) {
+        int8_t next = -1;
+        for (uint8_t i = 0; i < task_count; ++i) {
+            if (tried & (1 << i))
+                continue;
+            if (timeUntil(tasks[i].deadline, now) > 0)
+                continue;
+            if (next < 0 || timeUntil(tasks[i].deadline, tasks[next].deadline) < 0)
+                next = i;
+        }
+        if (next < 0)
+            return false;
+
+        tried |= 1 << next;
+        Task& task = tasks[next];
+
+        uint32_t late = now - task.deadline;
+        if (task.policy == CatchUp::Skip && late >= task.period) {
+            uint32_t missed = late / task.period + 1;
+            task.deadline += missed * task.period;
+            task.skipped += missed;
+            continue;
+        }
+
+        uint32_t begin = micros();
+        if (!task.function())
+            continue;  // keep the deadline so the task is picked again next time
+        uint32_t end = micros();
+        task.timing.record(task.deadline, begin, end);
+        if (end - begin > task.budget)
+            ++task.overruns;
+        ++task.iterations;
+
+        task.deadline += task.period;
+        if (task.policy != CatchUp::Burst && timeUntil(task.deadline, begin) <= 0) {
+            uint32_t missed = (begin - task.deadline) / task.period + 1;
+            task.deadline += missed * task.period;
+            task.skipped += missed;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,64 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <scheduler.h/cpp>
+
+    Runs periodic tasks from a fixed task table, one task per call, picking the earliest deadline first.
+
+*/
+
+#ifndef scheduler_h
+#define scheduler_h
+
+#include "Arduino.h"
+#include "timing.h"
+
+class Scheduler {
+   public:
+    // what to do with periods that passed while a task was waiting to run
+    enum class CatchUp : uint8_t {
+        Skip = 0,      // drop the late run entirely and wait for the next period boundary
+        Coalesce = 1,  // run once, then realign to the next period boundary
+        Burst = 2,     // run once for every missed period (the old RunProcess behaviour)
+    };
+
+    // returns false if the task could not do its work yet; it will be retried on the next call
+    using TaskFunction = bool (*)();
+
+    struct Task {
+        TaskFunction function;
+        uint32_t period;    // microseconds
+        uint32_t phase;     // microseconds after start()
+        uint32_t budget;    // microseconds
+        CatchUp policy;
+        uint32_t deadline;  // release time of the pending run, in micros()
+        uint32_t iterations;
+        uint32_t overruns;  // runs that took longer than the budget
+        uint32_t skipped;   // periods dropped or merged by the catch-up policy
+        TimingStats timing;
+    };
+
+    static const uint8_t MAX_TASKS = 8;
+
+    bool addTask(TaskFunction function, uint32_t period, uint32_t phase, uint32_t budget, CatchUp policy);
+
+    void start(uint32_t now);  // release every task at now + phase
+
+    bool run(uint32_t now);  // runs at most one due task; returns true if a task completed
+
+    uint8_t size() const {
+        return task_count;
+    }
+
+    const Task& task(uint8_t index) const {
+        return tasks[index];
+    }
+
+   private:
+    Task tasks[MAX_TASKS];
+    uint8_t task_count{0};
+};
+
+#endif
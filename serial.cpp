@@ -4,12 +4,17 @@
     *  License and other details available at: http://www.flybrix.com/firmware
 */
 
+#include "singlePrecision.h"
 #include "serial.h"
 #include "state.h"
 
 #include "config.h"  //CONFIG variable
 #include "control.h"
 #include "led.h"
+#include "BMP280.h"
+#include "MPU9250.h"
+#include "scheduler.h"
+#include "timing.h"
 
 namespace {
 using CobsPayloadGeneric = CobsPayload<500>;  // impacts memory use only; packet size should be <= client packet size
@@ -32,9 +37,19 @@ template <std::size_t N>
 inline void WritePIDData(CobsPayload<N>& payload, const PID& pid) {
     payload.Append(pid.lastTime(), pid.input(), pid.setpoint(), pid.pTerm(), pid.iTerm(), pid.dTerm());
 }
+
+template <std::size_t N>
+inline void WriteTimingStats(CobsPayload<N>& payload, const TimingStats& stats) {
+    for (uint8_t i = 0; i < TimingHistogram::BUCKETS; ++i)
+        payload.Append(stats.duration.counts()[i]);
+    for (uint8_t i = 0; i < TimingHistogram::BUCKETS; ++i)
+        payload.Append(stats.jitter.counts()[i]);
+}
 }
 
-SerialComm::SerialComm(State* state, const volatile uint16_t* ppm, const Control* control, const CONFIG_union* config, LED* led) : state{state}, ppm{ppm}, control{control}, config{config}, led{led} {
+SerialComm::SerialComm(State* state, const volatile uint16_t* ppm, const Control* control, const CONFIG_union* config, LED* led, const Scheduler* scheduler,
+                       MPU9250* mpu, BMP280* bmp)
+    : state{state}, ppm{ppm}, control{control}, config{config}, led{led}, scheduler{scheduler}, mpu{mpu}, bmp{bmp} {
 }
 
 void SerialComm::ReadData() {
@@ -138,6 +153,28 @@ void SerialComm::ProcessData() {
             ack_data |= COM_SET_LED;
         }
     }
+    if (mask & COM_REQ_TIMING) {
+        SendTiming();
+        ack_data |= COM_REQ_TIMING;
+    }
+    // acknowledged once the writes are queued; the drivers switch over when the sensor has confirmed them
+    if (mask & COM_SET_IMU_FILTERS) {
+        uint8_t gyro_filter, accel_filter;
+        if (data_input.ParseInto(gyro_filter, accel_filter) && mpu->setFilters(gyro_filter, accel_filter))
+            ack_data |= COM_SET_IMU_FILTERS;
+    }
+    if (mask & COM_SET_BARO_CONTROL) {
+        uint8_t ctrl_meas, baro_config;
+        if (data_input.ParseInto(ctrl_meas, baro_config) && bmp->setControl(ctrl_meas, baro_config))
+            ack_data |= COM_SET_BARO_CONTROL;
+    }
+    if (mask & COM_SET_BARO_COMPENSATION) {
+        uint8_t compensation;
+        if (data_input.ParseInto(compensation) && compensation <= (uint8_t)BMP280::Compensation::Float) {
+            bmp->setCompensation((BMP280::Compensation)compensation);
+            ack_data |= COM_SET_BARO_COMPENSATION;
+        }
+    }
 
     if (mask & COM_REQ_RESPONSE) {
         SendResponse(mask, ack_data);
@@ -279,7 +316,7 @@ void SerialComm::SendState(uint32_t timestamp_us, void (*extra_handler)(uint8_t*
     if (mask & SerialComm::STATE_MOTOR_OUT)
         payload.Append(state->MotorOut);
     if (mask & SerialComm::STATE_KINE_ANGLE)
-        payload.Append(state->kinematicsAngle);
+        payload.Append(state->kinematicsAngle());
     if (mask & SerialComm::STATE_KINE_RATE)
         payload.Append(state->kinematicsRate);
     if (mask & SerialComm::STATE_KINE_ALTITUDE)
@@ -296,6 +333,30 @@ void SerialComm::SendResponse(uint32_t mask, uint32_t response) const {
     WriteToOutput(payload);
 }
 
+void SerialComm::SendTiming() const {
+    // one message per source so each stays within the client packet size:
+    //   micros, source kind (0 = scheduled task, 1 = TimingProbe), source index, source count,
+    //   for tasks: period, run count, overruns, skipped periods,
+    //   then duration histogram, jitter histogram
+    uint32_t now = micros();
+    for (uint8_t i = 0; i < scheduler->size(); ++i) {
+        const Scheduler::Task& task = scheduler->task(i);
+        CobsPayloadGeneric payload;
+        WriteProtocolHead(MessageType::TimingData, 0xFFFFFFFF, payload);
+        payload.Append(now, uint8_t(0), i, scheduler->size());
+        payload.Append(task.period, task.iterations, task.overruns, task.skipped);
+        WriteTimingStats(payload, task.timing);
+        WriteToOutput(payload);
+    }
+    for (uint8_t i = 0; i < uint8_t(TimingProbe::Count); ++i) {
+        CobsPayloadGeneric payload;
+        WriteProtocolHead(MessageType::TimingData, 0xFFFFFFFF, payload);
+        payload.Append(now, uint8_t(1), i, uint8_t(TimingProbe::Count));
+        WriteTimingStats(payload, timing_probes[i]);
+        WriteToOutput(payload);
+    }
+}
+
 uint16_t SerialComm::GetSendStateDelay() const {
     return send_state_delay;
 }
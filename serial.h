@@ -15,8 +15,11 @@
 #include "cobs.h"
 
 union CONFIG_union;
+class BMP280;
 class Control;
 class LED;
+class MPU9250;
+class Scheduler;
 class State;
 
 class SerialComm {
@@ -28,6 +31,7 @@ class SerialComm {
         Timelog = 2,
         DebugString = 3,
         HistoryData = 4,
+        TimingData = 5,
     };
 
     enum CommandFields : uint32_t {
@@ -52,6 +56,10 @@ class SerialComm {
         COM_SET_STATE_DELAY = 1 << 15,
         COM_REQ_HISTORY = 1 << 16,
         COM_SET_LED = 1 << 17,
+        COM_REQ_TIMING = 1 << 18,
+        COM_SET_IMU_FILTERS = 1 << 19,        // MPU9250 gyro (1-6) and accel (0-7) DLPF settings
+        COM_SET_BARO_CONTROL = 1 << 20,       // BMP280 CTRL_MEAS and CONFIG register values
+        COM_SET_BARO_COMPENSATION = 1 << 21,  // BMP280 pressure formula: 0 int32, 1 int64, 2 float
     };
 
     enum StateFields : uint32_t {
@@ -86,7 +94,8 @@ class SerialComm {
         STATE_LOOP_COUNT = 1 << 27,
     };
 
-    explicit SerialComm(State* state, const volatile uint16_t* ppm, const Control* control, const CONFIG_union* config, LED* led);
+    explicit SerialComm(State* state, const volatile uint16_t* ppm, const Control* control, const CONFIG_union* config, LED* led, const Scheduler* scheduler,
+                        MPU9250* mpu, BMP280* bmp);
 
     void ReadData();
 
@@ -94,6 +103,7 @@ class SerialComm {
     void SendDebugString(const String& string, MessageType type = MessageType::DebugString) const;
     void SendState(uint32_t timestamp_us, void (*extra_handler)(uint8_t*, size_t) = nullptr, uint32_t mask = 0) const;
     void SendResponse(uint32_t mask, uint32_t response) const;
+    void SendTiming() const;
 
     uint16_t GetSendStateDelay() const;
     void SetStateMsg(uint32_t values);
@@ -110,6 +120,9 @@ class SerialComm {
     const Control* control;
     const CONFIG_union* config;
     LED* led;
+    const Scheduler* scheduler;
+    MPU9250* mpu;
+    BMP280* bmp;
     uint16_t send_state_delay{1001}; //anything over 1000 turns off state messages
     uint32_t state_mask{0x7fffff};
     CobsReader<500> data_input;
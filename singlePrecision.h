@@ -0,0 +1,21 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <singlePrecision.h>
+
+    Included first by every flight code translation unit and the sketch, so the headers they include are held to
+    the same rule.
+
+*/
+
+#ifndef singlePrecision_h
+#define singlePrecision_h
+
+// The Teensy 3.2's Cortex-M4 has no FPU, and a soft-float double operation costs about twice a float one, so a
+// float that silently meets a double literal or a double libm call pays for precision nobody uses. Refuse to
+// compile that instead: suffix literals with f and use sqrtf, atan2f and friends.
+#pragma GCC diagnostic error "-Wdouble-promotion"
+
+#endif
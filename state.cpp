@@ -4,7 +4,9 @@
     *  License and other details available at: http://www.flybrix.com/firmware
 */
 
+#include "singlePrecision.h"
 #include "state.h"
+#include "timing.h"
 
 // DEFAULT FILTER SETTINGS
 
@@ -98,49 +100,75 @@ boolean State::is(const uint16_t status_code) const {
 }
 
 void State::resetState() {
-    localization.setTime(0.0f);
-    kinematicsAngle[0] = 0.0f;  // radians -- pitch/roll/yaw (x,y,z)
-    kinematicsAngle[1] = 0.0f;
-    kinematicsAngle[2] = 0.0f;
+    kinematics_angle[0] = 0.0f;  // radians -- pitch/roll/yaw (x,y,z)
+    kinematics_angle[1] = 0.0f;
+    kinematics_angle[2] = 0.0f;
+    kinematics_angle_stale = false;
     kinematicsRate[0] = 0.0f;  // radians -- pitch/roll/yaw (x,y,z)
     kinematicsRate[1] = 0.0f;
     kinematicsRate[2] = 0.0f;
     kinematicsAltitude = 0.0f;  // meters
     p0 = pressure;              // reset filter to current value
     localization = Localization(0.0f, 1.0f, 0.0f, 0.0f, STATE_EXPECTED_TIME_STEP, FilterType::Madgwick, CONFIG.data.stateEstimationParameters, STATE_BARO_VARIANCE);
+    // samples are compared by signed time difference, so start the new filter from now rather than from zero
+    localization.setTime(micros());
 }
 
 float State::mixRadians(float w1, float a1, float a2) {
     float correction = 0.0f;
-    if ((a2 - a1) > PI)
-        correction = TWO_PI;
-    else if ((a2 - a1) < -PI)
-        correction = -TWO_PI;
+    if ((a2 - a1) > (float)PI)
+        correction = (float)TWO_PI;
+    else if ((a2 - a1) < -(float)PI)
+        correction = -(float)TWO_PI;
     return (1.0f - w1) * a2 + w1 * (a1 + correction);
 }
 
+void State::setAccelFilters(float attitude_hz, float vertical_hz, float sample_hz) {
+    for (uint8_t i = 0; i < 3; i++) {
+        attitude_accel_filter[i] = attitude_hz > 0.0f ? Biquad(attitude_hz, sample_hz) : Biquad();
+        attitude_accel_filter[i].reset(accel[i]);
+        vertical_accel_filter[i] = vertical_hz > 0.0f ? Biquad(vertical_hz, sample_hz) : Biquad();
+        vertical_accel_filter[i].reset(accel[i]);
+    }
+    attitude_accel_delay = (uint32_t)(attitude_accel_filter[0].groupDelay() * 1000000.0f / sample_hz);
+    vertical_accel_delay = (uint32_t)(vertical_accel_filter[0].groupDelay() * 1000000.0f / sample_hz);
+}
+
 void State::updateStateIMU(uint32_t currentTime) {
+    ScopedTiming timing(TimingProbe::StateIMU);
     // update IIRs (@500Hz)
     for (int i = 0; i < 3; i++) {
-        gyro_filter[i] = 0.1 * gyro[i] + 0.9 * gyro_filter[i];
-        accel_filter[i] = 0.1 * accel[i] + 0.9 * accel_filter[i];
-        accel_filter_sq[i] = 0.1 * accel[i] * accel[i] + 0.9 * accel_filter_sq[i];
+        gyro_filter[i] = 0.1f * gyro[i] + 0.9f * gyro_filter[i];
+        accel_filter[i] = 0.1f * accel[i] + 0.9f * accel_filter[i];
+        accel_filter_sq[i] = 0.1f * accel[i] * accel[i] + 0.9f * accel_filter_sq[i];
     }
 
+    float attitude_accel[3], vertical_accel[3];
     for (int i = 0; i < 3; i++) {
         kinematicsRate[i] = gyro[i] * DEG2RAD;
+        attitude_accel[i] = attitude_accel_filter[i].apply(accel[i]);
+        vertical_accel[i] = vertical_accel_filter[i].apply(accel[i]);
     }
-    localization.ProcessMeasurementIMU(currentTime, kinematicsRate, accel);
+    localization.ProcessMeasurementIMU(currentTime, kinematicsRate, attitude_accel, vertical_accel);
 
-    const float* q = localization.getAhrsQuaternion();
-    float r11 = 2.0f * (q[2] * q[3] + q[1] * q[0]);
-    float r12 = q[1] * q[1] + q[2] * q[2] - q[3] * q[3] - q[0] * q[0];
-    float r21 = -2.0f * (q[2] * q[0] - q[1] * q[3]);
-    float r31 = 2.0f * (q[3] * q[0] + q[1] * q[2]);
-    float r32 = q[1] * q[1] - q[2] * q[2] - q[3] * q[3] + q[0] * q[0];
-    kinematicsAngle[0] = -atan2(r11, r12);
-    kinematicsAngle[1] = asin(r21);
-    kinematicsAngle[2] = -atan2(r31, r32);
+    kinematics_angle_stale = true;
+}
+
+const float (&State::kinematicsAngle() const)[3] {
+    if (kinematics_angle_stale) {
+        const float* q = localization.getAhrsQuaternion();
+        float r11 = 2.0f * (q[2] * q[3] + q[1] * q[0]);
+        float r12 = q[1] * q[1] + q[2] * q[2] - q[3] * q[3] - q[0] * q[0];
+        float r21 = -2.0f * (q[2] * q[0] - q[1] * q[3]);
+        float r31 = 2.0f * (q[3] * q[0] + q[1] * q[2]);
+        float r32 = q[1] * q[1] - q[2] * q[2] - q[3] * q[3] + q[0] * q[0];
+        r21 = constrain(r21, -1.0f, 1.0f);  // a slightly denormalized q must not turn asin into NaN
+        kinematics_angle[0] = -atan2f(r11, r12);
+        kinematics_angle[1] = asinf(r21);
+        kinematics_angle[2] = -atan2f(r31, r32);
+        kinematics_angle_stale = false;
+    }
+    return kinematics_angle;
 }
 
 void State::updateStatePT(uint32_t currentTime) {
@@ -148,6 +176,6 @@ void State::updateStatePT(uint32_t currentTime) {
     kinematicsAltitude = localization.getElevation();
 }
 
-void State::updateStateMag() {
-    localization.ProcessMeasurementMagnetometer(mag);
+void State::updateStateMag(uint32_t currentTime) {
+    localization.ProcessMeasurementMagnetometer(currentTime, mag);
 }
@@ -13,6 +13,7 @@
 #define state_h
 
 #include "localization.h"
+#include "biquad.h"
 #include "config.h"  // for CONFIG
 
 class State {
@@ -56,7 +57,10 @@ class State {
     uint16_t MotorOut[8] = {0, 0, 0, 0, 0, 0, 0, 0};
 
     // Kinematics
-    float kinematicsAngle[3] = {0.0f, 0.0f, 0.0f};  // radians -- pitch/roll/yaw (x,y,z)
+    const float (&kinematicsAngle() const)[3];  // radians -- pitch/roll/yaw (x,y,z), derived from q when first asked for
+    const float* kinematicsQuaternion() const {  // AHRS attitude (w,x,y,z); level flight is a half turn about x
+        return localization.getAhrsQuaternion();
+    }
     float kinematicsRate[3] = {0.0f, 0.0f, 0.0f};  // radians/sec -- pitch/roll/yaw (x,y,z) rates
     float kinematicsAltitude = 0.0f;  // meters
 
@@ -66,9 +70,18 @@ class State {
     uint16_t enableAttempts = 0;  // increment when we're in the STATUS_ENABLING state
 
     void resetState();
+    // lowpass the accelerometer separately for the attitude correction and for vertical acceleration;
+    // a cutoff of 0 passes samples through unfiltered
+    void setAccelFilters(float attitude_hz, float vertical_hz, float sample_hz);
+    uint32_t attitudeAccelDelay() const {  // microseconds of group delay added in software
+        return attitude_accel_delay;
+    }
+    uint32_t verticalAccelDelay() const {
+        return vertical_accel_delay;
+    }
     void updateStateIMU(uint32_t currentTime);
     void updateStatePT(uint32_t currentTime);
-    void updateStateMag();
+    void updateStateMag(uint32_t currentTime);
 
     // const float* q; //quaternion storage for logging
     float q[4] = {1.0f, 0.0f, 0.0f, 0.0f};
@@ -83,6 +96,15 @@ class State {
 
     Localization localization;
 
+    // the quaternion is the attitude state; Euler angles are only derived for the readers that need them
+    mutable float kinematics_angle[3] = {0.0f, 0.0f, 0.0f};
+    mutable bool kinematics_angle_stale = false;
+
+    Biquad attitude_accel_filter[3];
+    Biquad vertical_accel_filter[3];
+    uint32_t attitude_accel_delay{0};
+    uint32_t vertical_accel_delay{0};
+
 };  // end of class State
 
 #define DEG2RAD 0.01745329251f
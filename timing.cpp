@@ -0,0 +1,32 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+*/
+
+#include "singlePrecision.h"
+#include "timing.h"
+
+TimingStats timing_probes[uint8_t(TimingProbe::Count)];
+
+void TimingHistogram::add(uint32_t value) {
+    uint8_t bucket = value ? 32 - __builtin_clz(value) : 0;
+    if (bucket >= BUCKETS)
+        bucket = BUCKETS - 1;
+    ++counts_[bucket];
+}
+
+void TimingStats::record(uint32_t intended_start, uint32_t start, uint32_t end) {
+    duration.add(end - start);
+    jitter.add(start - intended_start);
+    last_start = start;
+}
+
+void TimingStats::record(uint32_t start, uint32_t end) {
+    duration.add(end - start);
+    uint32_t interval = start - last_start;
+    if (last_start && last_interval)
+        jitter.add(interval > last_interval ? interval - last_interval : last_interval - interval);
+    last_interval = interval;
+    last_start = start;
+}
@@ -0,0 +1,71 @@
+/*
+    *  Flybrix Flight Controller -- Copyright 2015 Flying Selfie Inc.
+    *
+    *  License and other details available at: http://www.flybrix.com/firmware
+
+    <timing.h/cpp>
+
+    Fixed-memory histograms of execution time and start jitter, always compiled in.
+
+*/
+
+#ifndef timing_h
+#define timing_h
+
+#include "Arduino.h"
+
+class TimingHistogram {
+   public:
+    // bucket 0 counts zeros, bucket k counts values in [2^(k-1), 2^k), the last bucket also holds everything above
+    static const uint8_t BUCKETS = 16;
+
+    void add(uint32_t value);
+
+    const uint32_t* counts() const {
+        return counts_;
+    }
+
+   private:
+    uint32_t counts_[BUCKETS]{0};
+};
+
+struct TimingStats {
+    TimingHistogram duration;  // microseconds from start to end of a run
+    TimingHistogram jitter;    // microseconds of start jitter
+    uint32_t last_start{0};
+    uint32_t last_interval{0};
+
+    // jitter is the delay from the intended start time
+    void record(uint32_t intended_start, uint32_t start, uint32_t end);
+
+    // jitter is the change in interval between consecutive starts
+    void record(uint32_t start, uint32_t end);
+};
+
+// code paths that are not scheduled tasks but are timed anyway
+enum class TimingProbe : uint8_t {
+    I2CUpdate = 0,
+    StateIMU = 1,
+    ControlVectors = 2,
+    IMURead = 3,
+    Count = 4,
+};
+
+extern TimingStats timing_probes[uint8_t(TimingProbe::Count)];
+
+// times the enclosing scope
+class ScopedTiming {
+   public:
+    explicit ScopedTiming(TimingProbe probe) : stats(timing_probes[uint8_t(probe)]), start(micros()) {
+    }
+
+    ~ScopedTiming() {
+        stats.record(start, micros());
+    }
+
+   private:
+    TimingStats& stats;
+    uint32_t start;
+};
+
+#endif